@@ -0,0 +1,241 @@
+// Microbenchmarks of the simulation kernels. Every kernel is run in isolation
+// on the default level: after a warmup, each sample times a batch of calls and
+// the statistics of the time per call over all samples are written as JSON.
+//
+//   make bench                 or   ./nobuild bench
+//   ./bin/bench [--samples N] [--json FILE]
+#define COUT_NO_MAIN
+#include "cout.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_HAS_CYCLES 0
+#endif
+
+#define BENCH_WARMUP_SAMPLES 20
+#define BENCH_DEFAULT_SAMPLES 200
+#define BENCH_MAX_SAMPLES 100000
+
+typedef struct Benchmark_s {
+  const char *name;
+  int32_t batch;        // calls per sample
+  void (*setup)(void);  // prepares a sample, not timed
+  void (*run)(int32_t); // runs a batch of calls
+} Benchmark;
+
+typedef struct BenchStats_s {
+  double min;
+  double median;
+  double mean;
+  double p99;
+  double stddev;
+} BenchStats;
+
+static Game bench_game;
+static volatile uint64_t bench_sink; // keeps results alive
+
+uint64_t benchCycles(void) {
+#if BENCH_HAS_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/******* KERNELS ********/
+
+void setupLevel(void) { resetGame(&bench_game); }
+
+void runUpdateProj(const int32_t batch) {
+  Game *const game = &bench_game;
+  for (int32_t i = 0; i < batch; i++)
+    updateProj(&game->balls.proj[0], &game->targets, &game->particles,
+               &game->bar, &game->score);
+  bench_sink += game->score;
+}
+
+// A full pool of fresh particles, which all live longer than a batch
+void setupParticles(void) {
+  Particles *const particles = &bench_game.particles;
+  initializeParticles(particles);
+  const Vector2D pos = {.x = WINDOW_WIDTH / 2.0, .y = WINDOW_HEIGHT / 2.0};
+  while (particles->count < particles->capacity)
+    emitParticles(particles, &pos, TEXT_COLOR);
+}
+
+void runUpdateParticles(const int32_t batch) {
+  for (int32_t i = 0; i < batch; i++)
+    updateParticles(&bench_game.particles);
+  bench_sink += bench_game.particles.count;
+}
+
+void setupEmptyParticles(void) { initializeParticles(&bench_game.particles); }
+
+void runEmitParticles(const int32_t batch) {
+  const Vector2D pos = {.x = WINDOW_WIDTH / 2.0, .y = WINDOW_HEIGHT / 2.0};
+  for (int32_t i = 0; i < batch; i++)
+    emitParticles(&bench_game.particles, &pos, TEXT_COLOR);
+  bench_sink += bench_game.particles.count;
+}
+
+#define BENCH_RANDOM_NUMBERS 1024
+
+void runRandomFill(const int32_t batch) {
+  static float numbers[BENCH_RANDOM_NUMBERS];
+  for (int32_t i = 0; i < batch; i++)
+    randomFill(&bench_game.particles.random, numbers, BENCH_RANDOM_NUMBERS);
+  bench_sink += numbers[0] * BENCH_RANDOM_NUMBERS;
+}
+
+void runInitializeTargets(const int32_t batch) {
+  for (int32_t i = 0; i < batch; i++)
+    initializeTargets(&bench_game.targets);
+  bench_sink += bench_game.targets.alive_count;
+}
+
+void runLerpColor(const int32_t batch) {
+  color_t result = 0;
+  for (int32_t i = 0; i < batch; i++)
+    result ^= lerp_color_gamma_corrected(0xFF2E2EFF, 0x2EFF2EFF,
+                                         (float)i / batch);
+  bench_sink += result;
+}
+
+void runHasWon(const int32_t batch) {
+  // Loading the pointer every time keeps the call inside the loop
+  Targets *volatile targets = &bench_game.targets;
+  uint64_t won = 0;
+  for (int32_t i = 0; i < batch; i++)
+    won += hasWon(targets);
+  bench_sink += won;
+}
+
+static const Benchmark BENCHMARKS[] = {
+    {"updateProj", 1000, setupLevel, runUpdateProj},
+    {"updateParticles", 50, setupParticles, runUpdateParticles},
+    // 30 particles per call, so the default pool is not full after a batch
+    {"emitParticles", 25, setupEmptyParticles, runEmitParticles},
+    {"randomFill", 100, NULL, runRandomFill},
+    {"initializeTargets", 100, setupLevel, runInitializeTargets},
+    {"lerp_color_gamma_corrected", 1000, NULL, runLerpColor},
+    {"hasWon", 10000, setupLevel, runHasWon},
+};
+
+/******* STATISTICS ********/
+
+int compareDoubles(const void *const a, const void *const b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+BenchStats benchStats(double *const values, const int32_t n) {
+  qsort(values, n, sizeof(double), compareDoubles);
+  double sum = 0;
+  double sum_sq = 0;
+  for (int32_t i = 0; i < n; i++) {
+    sum += values[i];
+    sum_sq += values[i] * values[i];
+  }
+  const double mean = sum / n;
+  return (BenchStats){
+      .min = values[0],
+      .median = values[(n - 1) / 2],
+      .mean = mean,
+      .p99 = values[(n - 1) * 99 / 100],
+      .stddev = sqrt(fmax(sum_sq / n - mean * mean, 0)),
+  };
+}
+
+void writeStats(FILE *const file, const char *const key,
+                const BenchStats *const stats) {
+  fprintf(file,
+          "\"%s\": {\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, "
+          "\"p99\": %.3f, \"stddev\": %.3f}",
+          key, stats->min, stats->median, stats->mean, stats->p99,
+          stats->stddev);
+}
+
+// Times the samples of one benchmark and writes its JSON object
+void runBenchmark(const Benchmark *const bench, const int32_t samples,
+                  double *const ns, double *const cycles, FILE *const json) {
+  const double ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+  for (int32_t sample = -BENCH_WARMUP_SAMPLES; sample < samples; sample++) {
+    if (bench->setup)
+      bench->setup();
+    const uint64_t start_cycles = benchCycles();
+    const uint64_t start = SDL_GetPerformanceCounter();
+    bench->run(bench->batch);
+    const uint64_t ticks = SDL_GetPerformanceCounter() - start;
+    const uint64_t used_cycles = benchCycles() - start_cycles;
+    if (sample >= 0) {
+      ns[sample] = ticks * ns_per_tick / bench->batch;
+      cycles[sample] = (double)used_cycles / bench->batch;
+    }
+  }
+
+  const BenchStats ns_stats = benchStats(ns, samples);
+  const BenchStats cycle_stats = benchStats(cycles, samples);
+  fprintf(stderr, "%-28s %12.1f ns/call (median) %12.1f ns/call (p99)\n",
+          bench->name, ns_stats.median, ns_stats.p99);
+
+  fprintf(json,
+          "    {\"name\": \"%s\", \"batch\": %d, \"warmup_samples\": %d, "
+          "\"samples\": %d,\n      ",
+          bench->name, bench->batch, BENCH_WARMUP_SAMPLES, samples);
+  writeStats(json, "ns_per_call", &ns_stats);
+  fprintf(json, ",\n      ");
+  if (BENCH_HAS_CYCLES)
+    writeStats(json, "cycles_per_call", &cycle_stats);
+  else
+    fprintf(json, "\"cycles_per_call\": null");
+  fprintf(json, "}");
+}
+
+int main(int argc, char **argv) {
+  int32_t samples = BENCH_DEFAULT_SAMPLES;
+  const char *json_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+      samples = atoi(argv[++i]);
+      if (samples < 1 || samples > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "Invalid number of samples: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--samples N] [--json FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  initializeColorTables();
+  FILE *const json = json_path ? fopen(json_path, "w") : stdout;
+  double *const ns = malloc(sizeof(double) * samples);
+  double *const cycles = malloc(sizeof(double) * samples);
+  const Options options = defaultOptions();
+  const Level level = optionsLevel(&options);
+  if (!json || !ns || !cycles ||
+      !initializeGame(&bench_game, &level, options.seed)) {
+    fprintf(stderr, "Unable to set up the benchmarks\n");
+    return 1;
+  }
+
+  const int32_t count = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+  fprintf(json, "{\n  \"benchmarks\": [\n");
+  for (int32_t i = 0; i < count; i++) {
+    runBenchmark(&BENCHMARKS[i], samples, ns, cycles, json);
+    fprintf(json, i + 1 < count ? ",\n" : "\n");
+  }
+  fprintf(json, "  ]\n}\n");
+
+  if (json != stdout)
+    fclose(json);
+  free(ns);
+  free(cycles);
+  freeGame(&bench_game);
+  return 0;
+}
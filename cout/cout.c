@@ -1,8 +1,16 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #if defined(__EMSCRIPTEN__) || defined(__wasm__) || defined(__wasm32__) ||     \
     defined(__wasm64__)
@@ -11,13 +19,33 @@
 #define FOR_WASM 0
 #endif
 
+#if !FOR_WASM && !defined(_WIN32)
+#define POSIX_FILES 1 // flock and fsync
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#else
+#define POSIX_FILES 0
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#define NOUSER
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+#endif
+
 /****** GAME CONFIG ******/
 #if !FOR_WASM
 #define SAVE_HIGHSCORE 1
 #else
 #define SAVE_HIGHSCORE 0
 #endif
-#define HIGHSCORE_FILE_NAME "highscore.txt"
+#define LEADERBOARD_FILE_NAME "leaderboard.bin"
+#define HIGHSCORE_FILE_NAME "highscore.txt" // of older versions, imported once
 
 #define SCALING 1
 #define DEFAULT_WINDOW_WIDTH 1200
@@ -28,7 +56,6 @@
 #define TEXT_COLOR 0xDCDCDCFF
 
 #define FPS 60
-#define FRAME_TARGET_TIME_MS (1000.0 / FPS)
 #define DELTA_TIME_SEC (1.0 / FPS)
 
 #define PROJ_SPEED 350
@@ -38,28 +65,24 @@
 
 #define BAR_HEIGHT 20
 #define BAR_WIDTH 80
-#define BAR_START_X (WINDOW_WIDTH / 2.0 - BAR_WIDTH / 2.0)
-#define BAR_START_Y (7 * WINDOW_HEIGHT / 8.0)
 #define BAR_SPEED                                                              \
   (PROJ_SPEED - 1) // smaller than PROJ_SPEED to prevent Proj sticking to Bar
 #define BAR_COLOR 0xFF4040FF
 
 #define TARGET_X_SPACING 10
 #define TARGET_Y_SPACING 10
-#define TARGET_Y_NUMBER (10 * SCALING)
-#define TARGET_X_NUMBER (10 * SCALING)
+#define DEFAULT_TARGET_Y_NUMBER (10 * SCALING)
+#define DEFAULT_TARGET_X_NUMBER (10 * SCALING)
+#define MAX_TARGET_DIMENSION 4096
 #define TARGET_WIDTH BAR_WIDTH
 #define TARGET_HEIGHT BAR_HEIGHT
-#define TARGET_SPACE_HEIGHT                                                    \
-  (TARGET_Y_SPACING * (TARGET_Y_NUMBER - 1) + TARGET_HEIGHT * TARGET_Y_NUMBER)
-#define TARGET_SPACE_WIDTH                                                     \
-  (TARGET_X_SPACING * (TARGET_X_NUMBER - 1) + TARGET_WIDTH * TARGET_X_NUMBER)
-#define TARGET_NUMBER (TARGET_Y_NUMBER * TARGET_X_NUMBER)
-#define TARGET_Y_PADDING (WINDOW_HEIGHT / 10)
-#define TARGET_X_PADDING ((WINDOW_WIDTH - TARGET_SPACE_WIDTH) / 2)
+// Distance between the left (top) edges of two neighbouring targets:
+#define TARGET_X_PITCH (TARGET_WIDTH + TARGET_X_SPACING)
+#define TARGET_Y_PITCH (TARGET_HEIGHT + TARGET_Y_SPACING)
 #define TARGET_SCORE 100
 
-#define PARTICLE_NUMBER 1000
+#define DEFAULT_PARTICLE_NUMBER 1000
+#define MAX_PARTICLE_NUMBER (1 << 24)
 #define PARTICLE_TO_EMIT 30
 #define PARTICLE_TO_EMIT_VARIABILITY (PARTICLE_TO_EMIT / 4 * 2)
 #define PARTICLE_SIZE 10
@@ -77,7 +100,11 @@ typedef uint32_t color_t;
 
 /****** MACRO DEFINITIONS **********/
 
-#define FONT_FILEPATH "../Lato-Regular.ttf"
+#define FONT_FILE_NAME "Lato-Regular.ttf"
+// Build with EMBED_FONT=1 to compile the font into the executable
+#ifndef EMBED_FONT
+#define EMBED_FONT 0
+#endif
 #define TEXT_BUF_SIZE 100
 
 #define SIGN(x) (x >= 0 ? 1 : -1)
@@ -118,6 +145,129 @@ bool wasmShouldStop(void) { return should_stop; }
 
 #endif // FOR_WASM
 
+/******* TRACING *********/
+
+// Build with COUT_TRACE=1 to record the time spent in the zones marked with
+// TRACE_ZONE. A zone lasts until the end of the enclosing block. Every thread
+// records into its own buffer, which is allocated when the thread enters its
+// first zone, and traceWrite saves all of them in the Chrome trace event
+// format, which can be opened in Perfetto or chrome://tracing. Without
+// COUT_TRACE the zones compile to nothing.
+#ifndef COUT_TRACE
+#define COUT_TRACE 0
+#endif
+
+#define TRACE_FILE_NAME "cout_trace.json"
+
+#if COUT_TRACE
+#define TRACE_MAX_THREADS 64
+#define TRACE_EVENTS_PER_THREAD (1 << 18)
+
+typedef struct TraceEvent_s {
+  const char *name; // must be a string literal
+  uint64_t begin;   // performance counter ticks
+  uint64_t end;
+} TraceEvent;
+
+typedef struct TraceBuffer_s {
+  TraceEvent *events;
+  uint32_t count;
+  uint64_t dropped; // zones that did not fit into the buffer
+} TraceBuffer;
+
+static TraceBuffer trace_buffers[TRACE_MAX_THREADS];
+static SDL_atomic_t trace_thread_count;
+static _Thread_local TraceBuffer *trace_thread_buffer;
+
+// Returns NULL if there are too many threads or the allocation failed
+TraceBuffer *traceThreadBuffer(void) {
+  if (trace_thread_buffer)
+    return trace_thread_buffer;
+  const int thread = SDL_AtomicAdd(&trace_thread_count, 1);
+  if (thread >= TRACE_MAX_THREADS)
+    return NULL;
+  TraceBuffer *const buffer = &trace_buffers[thread];
+  buffer->events = malloc(sizeof(TraceEvent) * TRACE_EVENTS_PER_THREAD);
+  if (!buffer->events)
+    return NULL;
+  trace_thread_buffer = buffer;
+  return buffer;
+}
+
+// Index of the event in the buffer of the thread or -1 if it is not recorded
+int32_t traceZoneBegin(const char *const name) {
+  TraceBuffer *const buffer = traceThreadBuffer();
+  if (!buffer)
+    return -1;
+  if (buffer->count >= TRACE_EVENTS_PER_THREAD) {
+    buffer->dropped++;
+    return -1;
+  }
+  TraceEvent *const event = &buffer->events[buffer->count];
+  event->name = name;
+  event->begin = SDL_GetPerformanceCounter();
+  event->end = event->begin;
+  return buffer->count++;
+}
+
+void traceZoneEnd(const int32_t *const event) {
+  if (*event >= 0)
+    trace_thread_buffer->events[*event].end = SDL_GetPerformanceCounter();
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name)                                                       \
+  const int32_t TRACE_CONCAT(trace_zone_, __LINE__)                            \
+      __attribute__((cleanup(traceZoneEnd))) = traceZoneBegin(name)
+
+// Call after all other threads have stopped
+void traceWrite(const char *const path) {
+  const int threads = SDL_AtomicGet(&trace_thread_count);
+  const int buffers = threads < TRACE_MAX_THREADS ? threads : TRACE_MAX_THREADS;
+  FILE *const file = fopen(path, "w");
+  if (!file) {
+    SDL_Log("Unable to write the trace to %s", path);
+    return;
+  }
+  uint64_t start = UINT64_MAX;
+  for (int thread = 0; thread < buffers; thread++) {
+    const TraceBuffer *const buffer = &trace_buffers[thread];
+    if (buffer->count > 0 && buffer->events[0].begin < start)
+      start = buffer->events[0].begin;
+  }
+  const double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+  bool first = true;
+  uint64_t dropped = 0;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+  for (int thread = 0; thread < buffers; thread++) {
+    const TraceBuffer *const buffer = &trace_buffers[thread];
+    dropped += buffer->dropped;
+    for (uint32_t i = 0; i < buffer->count; i++) {
+      const TraceEvent *const event = &buffer->events[i];
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",\n", event->name, thread,
+              (event->begin - start) * us_per_tick,
+              (event->end - event->begin) * us_per_tick);
+      first = false;
+    }
+  }
+  fputs("\n]}\n", file);
+  fclose(file);
+  SDL_Log("Wrote the trace to %s (%" PRIu64 " zones dropped)", path, dropped);
+}
+
+#else
+#define TRACE_ZONE(name)                                                       \
+  do {                                                                         \
+  } while (0)
+#define traceWrite(path)                                                       \
+  do {                                                                         \
+  } while (0)
+#endif // COUT_TRACE
+
 /******* GAME MECHANICS ********/
 
 typedef struct Vector2D_s {
@@ -149,90 +299,423 @@ void drawBackground(SDL_Renderer *const renderer) {
   }
 }
 
-void renderSurface(SDL_Renderer *const renderer, SDL_Surface *const surface,
-                   const Vector2D *pos) {
+/******* GEOMETRY BATCHING ********/
+
+// All rectangles of a frame are collected into vertex buffers and submitted
+// with one SDL_RenderGeometry call per batch, instead of one
+// SDL_SetRenderDrawColor and SDL_RenderFillRect per rectangle. Opaque and
+// blended rectangles are kept in separate batches because the blend mode
+// applies to a whole call. A full batch is drawn and emptied, so the capacity
+// only limits the size of a single call.
+#define MAX_BATCH_QUADS 16384
+
+typedef struct GeometryBatch_s {
+  SDL_Renderer *renderer;
+  SDL_BlendMode blend_mode;
+  SDL_Vertex *vertices; // 4 per quad
+  int *indices;         // 6 per quad, filled once on initialization
+  int32_t quads;
+  int32_t capacity; // in quads
+} GeometryBatch;
+
+bool initializeGeometryBatch(GeometryBatch *const batch,
+                             SDL_Renderer *const renderer,
+                             const SDL_BlendMode blend_mode,
+                             int32_t capacity) {
+  capacity = capacity > MAX_BATCH_QUADS ? MAX_BATCH_QUADS : capacity;
+  *batch = (GeometryBatch){
+      .renderer = renderer,
+      .blend_mode = blend_mode,
+      .vertices = malloc(sizeof(SDL_Vertex) * 4 * capacity),
+      .indices = malloc(sizeof(int) * 6 * capacity),
+      .quads = 0,
+      .capacity = capacity,
+  };
+  if (!batch->vertices || !batch->indices)
+    return false;
+
+  for (int32_t quad = 0; quad < capacity; quad++) {
+    const int first = 4 * quad;
+    int *const indices = &batch->indices[6 * quad];
+    indices[0] = first + 0;
+    indices[1] = first + 1;
+    indices[2] = first + 2;
+    indices[3] = first + 2;
+    indices[4] = first + 3;
+    indices[5] = first + 0;
+  }
+  return true;
+}
+
+void freeGeometryBatch(GeometryBatch *const batch) {
+  free(batch->vertices);
+  free(batch->indices);
+  *batch = (GeometryBatch){0};
+}
+
+// Draws all rectangles of the batch in one call and empties it.
+void submitBatch(GeometryBatch *const batch) {
+  if (batch->quads == 0)
+    return;
+  SDL_SetRenderDrawBlendMode(batch->renderer, batch->blend_mode);
+  if (SDL_RenderGeometry(batch->renderer, NULL, batch->vertices,
+                         4 * batch->quads, batch->indices, 6 * batch->quads)) {
+    SDL_Log("SDL_RenderGeometry: %s\n", SDL_GetError());
+  }
+  batch->quads = 0;
+}
+
+void writeQuad(SDL_Vertex *const vertices, const SDL_Rect *const rect,
+               const color_t color) {
+  const SDL_Color sdl_color = colorToSdlColor(color);
+  const float x0 = rect->x;
+  const float y0 = rect->y;
+  const float x1 = rect->x + rect->w;
+  const float y1 = rect->y + rect->h;
+  vertices[0] = (SDL_Vertex){.position = {x0, y0}, .color = sdl_color};
+  vertices[1] = (SDL_Vertex){.position = {x1, y0}, .color = sdl_color};
+  vertices[2] = (SDL_Vertex){.position = {x1, y1}, .color = sdl_color};
+  vertices[3] = (SDL_Vertex){.position = {x0, y1}, .color = sdl_color};
+}
+
+void batchRect(GeometryBatch *const batch, const SDL_Rect *const rect,
+               const color_t color) {
+  if (batch->quads >= batch->capacity)
+    submitBatch(batch);
+  writeQuad(&batch->vertices[4 * batch->quads], rect, color);
+  batch->quads++;
+}
+
+typedef struct RenderBatches_s {
+  GeometryBatch opaque;  // bricks, bar and ball
+  GeometryBatch blended; // particles
+} RenderBatches;
+
+/******* TEXT RENDERING ********/
+
+// Rasterizing text with SDL_ttf and uploading it as a texture is by far the
+// most expensive thing in a frame, so all rendered strings are cached as
+// textures. The HUD scores are composed from cached digit glyphs, such that a
+// changing score does not need any rasterization either.
+
+#define TEXT_CACHE_SIZE 32
+
+typedef struct TextCacheEntry_s {
+  SDL_Texture *texture; // NULL if the entry is unused
+  TTF_Font *font;
+  color_t color;
+  uint32_t hash;
+  char text[TEXT_BUF_SIZE];
+  int32_t w;
+  int32_t h;
+  uint64_t last_used;
+} TextCacheEntry;
+
+typedef struct DigitGlyphs_s {
+  TTF_Font *font; // NULL if the glyphs are not rendered yet
+  color_t color;
+  SDL_Texture *textures[10];
+  int32_t w[10];
+  int32_t h;
+} DigitGlyphs;
+
+typedef struct TextCache_s {
+  SDL_Renderer *renderer;
+  uint64_t clock; // incremented on every lookup, used for LRU eviction
+  TextCacheEntry entries[TEXT_CACHE_SIZE];
+  DigitGlyphs digits;
+} TextCache;
+
+void initializeTextCache(TextCache *const cache, SDL_Renderer *const renderer) {
+  *cache = (TextCache){.renderer = renderer};
+}
+
+void clearTextCache(TextCache *const cache) {
+  for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+    if (cache->entries[i].texture)
+      SDL_DestroyTexture(cache->entries[i].texture);
+  }
+  for (int i = 0; i < 10; i++) {
+    if (cache->digits.textures[i])
+      SDL_DestroyTexture(cache->digits.textures[i]);
+  }
+  initializeTextCache(cache, cache->renderer);
+}
+
+// FNV-1a
+uint32_t hashText(const char *text) {
+  uint32_t hash = 2166136261u;
+  while (*text) {
+    hash ^= (uint8_t)*text++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Only uses the font, so it may run on another thread than the renderer
+SDL_Surface *rasterizeText(const char *const text, const color_t color,
+                           TTF_Font *const font) {
+  TRACE_ZONE("rasterizeText");
+  SDL_Surface *const surface =
+      TTF_RenderText_Solid(font, text, colorToSdlColor(color));
+  if (!surface)
+    SDL_Log("TTF_RenderText_Solid: %s\n", TTF_GetError());
+  return surface;
+}
+
+SDL_Texture *createSurfaceTexture(SDL_Renderer *const renderer,
+                                  SDL_Surface *const surface, int32_t *const w,
+                                  int32_t *const h) {
   SDL_Texture *const texture = SDL_CreateTextureFromSurface(renderer, surface);
   if (!texture) {
     SDL_Log("SDL_CreateTextureFromSurface: %s\n", SDL_GetError());
-    return;
+  } else {
+    *w = surface->w;
+    *h = surface->h;
+  }
+  return texture;
+}
+
+SDL_Texture *createTextTexture(SDL_Renderer *const renderer,
+                               const char *const text, const color_t color,
+                               TTF_Font *const font, int32_t *const w,
+                               int32_t *const h) {
+  TRACE_ZONE("createTextTexture");
+  SDL_Surface *const surface = rasterizeText(text, color, font);
+  if (!surface)
+    return NULL;
+  SDL_Texture *const texture = createSurfaceTexture(renderer, surface, w, h);
+  SDL_FreeSurface(surface);
+  return texture;
+}
+
+// Returns the entry of the text or NULL and in lru the entry to replace.
+TextCacheEntry *findCachedText(TextCache *const cache, const char *const text,
+                               const uint32_t hash, const color_t color,
+                               TTF_Font *const font,
+                               TextCacheEntry **const lru) {
+  cache->clock++;
+  *lru = &cache->entries[0];
+  for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+    TextCacheEntry *const entry = &cache->entries[i];
+    if (entry->texture && entry->hash == hash && entry->font == font &&
+        entry->color == color && !strcmp(entry->text, text)) {
+      entry->last_used = cache->clock;
+      return entry;
+    }
+    if (!entry->texture ||
+        ((*lru)->texture && entry->last_used < (*lru)->last_used))
+      *lru = entry;
+  }
+  return NULL;
+}
+
+const TextCacheEntry *storeCachedText(TextCache *const cache,
+                                      TextCacheEntry *const entry,
+                                      const char *const text,
+                                      const uint32_t hash, const color_t color,
+                                      TTF_Font *const font,
+                                      SDL_Texture *const texture,
+                                      const int32_t w, const int32_t h) {
+  if (entry->texture)
+    SDL_DestroyTexture(entry->texture);
+  *entry = (TextCacheEntry){
+      .texture = texture,
+      .font = font,
+      .color = color,
+      .hash = hash,
+      .w = w,
+      .h = h,
+      .last_used = cache->clock,
   };
+  strcpy(entry->text, text);
+  return entry;
+}
+
+// Returns the cached texture of the text and renders it on a cache miss.
+// Returns NULL if the text could not be rendered or is too long to be cached.
+const TextCacheEntry *getCachedText(TextCache *const cache,
+                                    const char *const text,
+                                    const color_t color,
+                                    TTF_Font *const font) {
+  if (strlen(text) >= TEXT_BUF_SIZE)
+    return NULL;
+
+  const uint32_t hash = hashText(text);
+  TextCacheEntry *lru;
+  const TextCacheEntry *const entry =
+      findCachedText(cache, text, hash, color, font, &lru);
+  if (entry)
+    return entry;
+
+  int32_t w = 0;
+  int32_t h = 0;
+  SDL_Texture *const texture =
+      createTextTexture(cache->renderer, text, color, font, &w, &h);
+  if (!texture)
+    return NULL;
+  return storeCachedText(cache, lru, text, hash, color, font, texture, w, h);
+}
+
+// Adds a text that was rasterized ahead and frees its surface.
+void cacheTextSurface(TextCache *const cache, const char *const text,
+                      const color_t color, TTF_Font *const font,
+                      SDL_Surface *const surface) {
+  int32_t w = 0;
+  int32_t h = 0;
+  SDL_Texture *const texture =
+      strlen(text) < TEXT_BUF_SIZE
+          ? createSurfaceTexture(cache->renderer, surface, &w, &h)
+          : NULL;
+  SDL_FreeSurface(surface);
+  if (!texture)
+    return;
+  const uint32_t hash = hashText(text);
+  TextCacheEntry *lru;
+  TextCacheEntry *const entry =
+      findCachedText(cache, text, hash, color, font, &lru);
+  storeCachedText(cache, entry ? entry : lru, text, hash, color, font, texture,
+                  w, h);
+}
 
-  const SDL_Rect rect = createSdlRect(pos->x, pos->y, surface->w, surface->h);
+void renderTexture(SDL_Renderer *const renderer, SDL_Texture *const texture,
+                   const int32_t w, const int32_t h, const Vector2D *pos) {
+  const SDL_Rect rect = createSdlRect(pos->x, pos->y, w, h);
   SDL_RenderCopy(renderer, texture, NULL, &rect);
-  SDL_DestroyTexture(texture);
 }
 
-void renderText(SDL_Renderer *const renderer, const char *const text,
-                color_t color, const Vector2D *const pos,
-                TTF_Font *const font) {
-  SDL_Color sdl_color = colorToSdlColor(color);
-  SDL_Surface *const surface = TTF_RenderText_Solid(font, text, sdl_color);
-  if (!surface) {
-    SDL_Log("TTF_RenderText_Solid: %s\n", TTF_GetError());
+void renderText(TextCache *const cache, const char *const text, color_t color,
+                const Vector2D *const pos, TTF_Font *const font) {
+  TRACE_ZONE("renderText");
+  const TextCacheEntry *const entry = getCachedText(cache, text, color, font);
+  if (!entry)
     return;
-  };
-  renderSurface(renderer, surface, pos);
-  SDL_FreeSurface(surface);
+  renderTexture(cache->renderer, entry->texture, entry->w, entry->h, pos);
 }
 
-void renderXYCenteredText(SDL_Renderer *const renderer, const char *const text,
+void renderXYCenteredText(TextCache *const cache, const char *const text,
                           color_t color, TTF_Font *const font) {
-  const SDL_Color sdl_color = colorToSdlColor(color);
-  SDL_Surface *const surface = TTF_RenderText_Solid(font, text, sdl_color);
-  if (!surface) {
-    SDL_Log("TTF_RenderText_Solid: %s\n", TTF_GetError());
+  const TextCacheEntry *const entry = getCachedText(cache, text, color, font);
+  if (!entry)
     return;
-  };
   const Vector2D pos = {
-      .x = ((float)(uint32_t)WINDOW_WIDTH - surface->w) / 2,
-      .y = ((float)(uint32_t)WINDOW_HEIGHT - surface->h) / 2,
+      .x = ((float)(uint32_t)WINDOW_WIDTH - entry->w) / 2,
+      .y = ((float)(uint32_t)WINDOW_HEIGHT - entry->h) / 2,
   };
-  renderSurface(renderer, surface, &pos);
-  SDL_FreeSurface(surface);
+  renderTexture(cache->renderer, entry->texture, entry->w, entry->h, &pos);
 }
 
-void renderYCenteredText(SDL_Renderer *const renderer, const char *const text,
+void renderYCenteredText(TextCache *const cache, const char *const text,
                          const color_t color, TTF_Font *const font,
                          const uint32_t x_pos) {
-  const SDL_Color sdl_color = colorToSdlColor(color);
-  SDL_Surface *const surface = TTF_RenderText_Solid(font, text, sdl_color);
-  if (!surface) {
-    SDL_Log("TTF_RenderText_Solid: %s\n", TTF_GetError());
+  const TextCacheEntry *const entry = getCachedText(cache, text, color, font);
+  if (!entry)
     return;
-  };
   const Vector2D pos = {.x = x_pos,
-                        .y = ((float)(uint32_t)WINDOW_HEIGHT - surface->h) / 2};
-  renderSurface(renderer, surface, &pos);
-  SDL_FreeSurface(surface);
+                        .y = ((float)(uint32_t)WINDOW_HEIGHT - entry->h) / 2};
+  renderTexture(cache->renderer, entry->texture, entry->w, entry->h, &pos);
 }
 
-void renderXCenteredText(SDL_Renderer *const renderer, const char *const text,
+void renderXCenteredText(TextCache *const cache, const char *const text,
                          const color_t color, TTF_Font *const font,
                          const uint32_t y_pos) {
-  const SDL_Color sdl_color = colorToSdlColor(color);
-  SDL_Surface *const surface = TTF_RenderText_Solid(font, text, sdl_color);
-  if (!surface) {
-    SDL_Log("TTF_RenderText_Solid: %s\n", TTF_GetError());
+  const TextCacheEntry *const entry = getCachedText(cache, text, color, font);
+  if (!entry)
     return;
-  };
   const Vector2D pos = {
-      .x = ((float)(uint32_t)WINDOW_WIDTH - surface->w) / 2,
+      .x = ((float)(uint32_t)WINDOW_WIDTH - entry->w) / 2,
       .y = y_pos,
   };
-  renderSurface(renderer, surface, &pos);
-  SDL_FreeSurface(surface);
+  renderTexture(cache->renderer, entry->texture, entry->w, entry->h, &pos);
+}
+
+bool rasterizeDigitGlyphs(SDL_Surface **const surfaces, const color_t color,
+                          TTF_Font *const font) {
+  for (int i = 0; i < 10; i++) {
+    const char glyph[2] = {'0' + i, '\0'};
+    surfaces[i] = rasterizeText(glyph, color, font);
+    if (!surfaces[i]) {
+      while (i-- > 0)
+        SDL_FreeSurface(surfaces[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Uploads the glyphs 0-9 of the font and color and frees their surfaces.
+bool setDigitGlyphs(TextCache *const cache, const color_t color,
+                    TTF_Font *const font, SDL_Surface *const *const surfaces) {
+  DigitGlyphs *const digits = &cache->digits;
+  for (int i = 0; i < 10; i++) {
+    if (digits->textures[i])
+      SDL_DestroyTexture(digits->textures[i]);
+    digits->textures[i] = NULL;
+  }
+  digits->font = NULL;
+  bool uploaded = true;
+  for (int i = 0; i < 10; i++) {
+    if (uploaded)
+      digits->textures[i] = createSurfaceTexture(
+          cache->renderer, surfaces[i], &digits->w[i], &digits->h);
+    uploaded = uploaded && digits->textures[i];
+    SDL_FreeSurface(surfaces[i]);
+  }
+  if (!uploaded)
+    return false;
+  digits->font = font;
+  digits->color = color;
+  return true;
+}
+
+// Renders the glyphs 0-9 once for the given font and color.
+bool prepareDigitGlyphs(TextCache *const cache, const color_t color,
+                        TTF_Font *const font) {
+  DigitGlyphs *const digits = &cache->digits;
+  if (digits->font == font && digits->color == color)
+    return true;
+  SDL_Surface *surfaces[10];
+  return rasterizeDigitGlyphs(surfaces, color, font) &&
+         setDigitGlyphs(cache, color, font, surfaces);
+}
+
+// Renders the label followed by the number, where the number is composed of
+// the cached digit glyphs. Returns the x coordinate after the last digit.
+float renderNumber(TextCache *const cache, const char *const label,
+                   uint64_t number, const color_t color,
+                   const Vector2D *const pos, TTF_Font *const font) {
+  const TextCacheEntry *const entry = getCachedText(cache, label, color, font);
+  if (!entry || !prepareDigitGlyphs(cache, color, font))
+    return pos->x;
+  renderTexture(cache->renderer, entry->texture, entry->w, entry->h, pos);
+
+  uint8_t digits[20]; // enough for UINT64_MAX
+  int count = 0;
+  do {
+    digits[count++] = number % 10;
+    number /= 10;
+  } while (number > 0);
+
+  Vector2D digit_pos = {.x = pos->x + entry->w, .y = pos->y};
+  const DigitGlyphs *const glyphs = &cache->digits;
+  while (count > 0) {
+    const uint8_t digit = digits[--count];
+    renderTexture(cache->renderer, glyphs->textures[digit], glyphs->w[digit],
+                  glyphs->h, &digit_pos);
+    digit_pos.x += glyphs->w[digit];
+  }
+  return digit_pos.x;
 }
 
+#define SCORE_LABEL "Score: "
+#define HIGHSCORE_LABEL "Best: "
+
 void writeScore(const uint64_t score, const uint64_t highscore,
-                SDL_Renderer *const renderer, TTF_Font *const score_font) {
-  char score_text[TEXT_BUF_SIZE];
-  sprintf(score_text, "Score: %lu", score);
-  renderText(renderer, score_text, TEXT_COLOR, &(Vector2D){.x = 10, .y = 10},
-             score_font);
-  char highscoreText[TEXT_BUF_SIZE];
-  sprintf(highscoreText, "Best: %lu", highscore);
-  renderText(renderer, highscoreText, TEXT_COLOR, &(Vector2D){.x = 10, .y = 30},
-             score_font);
+                TextCache *const cache, TTF_Font *const score_font) {
+  renderNumber(cache, SCORE_LABEL, score, TEXT_COLOR,
+               &(Vector2D){.x = 10, .y = 10}, score_font);
+  renderNumber(cache, HIGHSCORE_LABEL, highscore, TEXT_COLOR,
+               &(Vector2D){.x = 10, .y = 30}, score_font);
 }
 
 Vector2D vecMult(const Vector2D *const vec, const float scalar) {
@@ -256,6 +739,323 @@ Vector2D addVec(const Vector2D *const a, const Vector2D *const b) {
   };
 }
 
+/******* LEVEL ********/
+
+// The size of the target grid and the particle capacity are chosen at startup.
+// Targets keep their size, so the world grows with the grid and is scaled down
+// to fit the window when it is drawn. The balls and the bar grow and speed up
+// with the world, so they look and move the same in the window.
+#define LEVEL_TARGETS_MAX_WIDTH 0.75  // of the world width
+#define LEVEL_TARGETS_MAX_HEIGHT 0.4  // of the world height
+
+typedef struct Level_s {
+  int32_t cols;
+  int32_t rows;
+  int32_t particle_capacity;
+  int32_t ball_capacity;
+  uint32_t target_number;
+  uint32_t target_words; // 64 targets per word of alive bits
+  int32_t width;         // size of the world
+  int32_t height;
+  float scale; // world units per window pixel, >= 1
+  int32_t target_x_padding;
+  int32_t target_y_padding;
+  int32_t proj_speed; // PROJ_SPEED and friends times the scale
+  int32_t proj_width;
+  int32_t proj_height;
+  int32_t bar_speed;
+  int32_t bar_width;
+  int32_t bar_height;
+} Level;
+
+Level initialLevel(const int32_t cols, const int32_t rows,
+                   const int32_t particle_capacity,
+                   const int32_t ball_capacity) {
+  const int32_t space_width =
+      TARGET_X_SPACING * (cols - 1) + TARGET_WIDTH * cols;
+  const int32_t space_height =
+      TARGET_Y_SPACING * (rows - 1) + TARGET_HEIGHT * rows;
+  const float scale =
+      fmaxf(1, fmaxf(space_width / (LEVEL_TARGETS_MAX_WIDTH * WINDOW_WIDTH),
+                     space_height / (LEVEL_TARGETS_MAX_HEIGHT * WINDOW_HEIGHT)));
+  const int32_t width = ceilf(WINDOW_WIDTH * scale);
+  const int32_t height = ceilf(WINDOW_HEIGHT * scale);
+  return (Level){
+      .cols = cols,
+      .rows = rows,
+      .particle_capacity = particle_capacity,
+      .ball_capacity = ball_capacity,
+      .target_number = (uint32_t)cols * rows,
+      .target_words = ((uint32_t)cols * rows + 63) / 64,
+      .width = width,
+      .height = height,
+      .scale = scale,
+      .target_x_padding = (width - space_width) / 2,
+      .target_y_padding = height / 10,
+      .proj_speed = roundf(PROJ_SPEED * scale),
+      .proj_width = roundf(PROJ_WIDTH * scale),
+      .proj_height = roundf(PROJ_HEIGHT * scale),
+      .bar_speed = roundf(BAR_SPEED * scale),
+      .bar_width = roundf(BAR_WIDTH * scale),
+      .bar_height = roundf(BAR_HEIGHT * scale),
+  };
+}
+
+float barStartX(const Level *const level) {
+  return (float)(uint32_t)(level->width / 2.0 - level->bar_width / 2.0);
+}
+
+float barStartY(const Level *const level) {
+  return (float)(uint32_t)(7 * level->height / 8.0);
+}
+
+/******* ARENA ********/
+
+// All state of a level is allocated from one block that is allocated at
+// startup. Restarting a level rewinds the arena instead of freeing and
+// allocating again.
+#define ARENA_ALIGNMENT 32 // enough for aligned AVX loads
+#define ARENA_SIZE(bytes)                                                      \
+  (((size_t)(bytes) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+typedef struct Arena_s {
+  void *allocation;
+  uint8_t *base; // allocation rounded up to ARENA_ALIGNMENT
+  size_t size;
+  size_t used;
+} Arena;
+
+bool initializeArena(Arena *const arena, const size_t size) {
+  *arena = (Arena){.allocation = malloc(size + ARENA_ALIGNMENT - 1)};
+  if (!arena->allocation)
+    return false;
+  arena->base = (uint8_t *)ARENA_SIZE((uintptr_t)arena->allocation);
+  arena->size = size;
+  return true;
+}
+
+void freeArena(Arena *const arena) {
+  free(arena->allocation);
+  *arena = (Arena){0};
+}
+
+void arenaReset(Arena *const arena) { arena->used = 0; }
+
+// Returns NULL if the arena is exhausted
+void *arenaAlloc(Arena *const arena, const size_t bytes) {
+  const size_t size = ARENA_SIZE(bytes);
+  if (size > arena->size - arena->used)
+    return NULL;
+  void *const ptr = arena->base + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+/******* JOB SYSTEM ********/
+
+// A small work-stealing thread pool for loops whose iterations are
+// independent. parallelFor cuts [0, count) into chunks that are a multiple of
+// a cache line of floats, so two workers never write the same cache line of a
+// float array, and deals out an equal range of chunks to every worker. A
+// worker takes chunks from the front of its own range and steals from the back
+// of the ranges of the others once it runs dry. The caller works as worker 0.
+// Small loops, loops started while the pool is busy with the job of another
+// thread and builds without threads run serially on the caller.
+#define CACHE_LINE 64
+#define MAX_JOB_WORKERS 31
+#define JOB_CHUNK_ALIGNMENT (CACHE_LINE / sizeof(float))
+#define PARALLEL_MIN_ITEMS 8192 // below this the loop runs serially
+// The caller spins for the last chunks of the others, which usually takes a few
+// microseconds, and gives up its time slice after that many spins, in case a
+// worker was preempted.
+#define JOB_WAIT_SPINS 4096
+
+#if defined(SDL_CPUPauseInstruction) // SDL 2.24 or newer
+#define CPU_PAUSE() SDL_CPUPauseInstruction()
+#elif defined(__SSE2__)
+#define CPU_PAUSE() _mm_pause()
+#else
+#define CPU_PAUSE()
+#endif
+
+// Processes [begin, end). worker is in [0, MAX_JOB_WORKERS] and can be used to
+// index per worker outputs.
+typedef void (*JobFunction)(void *data, int32_t begin, int32_t end,
+                            int32_t worker);
+
+typedef struct Job_s {
+  uint32_t id;
+  JobFunction function;
+  void *data;
+  int32_t count;
+  int32_t chunk_size;
+} Job;
+
+typedef struct JobQueue_s {
+  _Alignas(CACHE_LINE) SDL_SpinLock lock;
+  uint32_t job; // id of the job the chunks belong to
+  int32_t next; // first chunk that has not been taken
+  int32_t end;
+} JobQueue;
+
+// A result of a worker that is on its own cache line
+typedef struct JobCounter_s {
+  _Alignas(CACHE_LINE) int32_t value;
+} JobCounter;
+
+typedef struct JobPool_s {
+  SDL_Thread *threads[MAX_JOB_WORKERS];
+  int32_t worker_count; // without the caller of parallelFor
+  SDL_mutex *mutex;     // guards job and stop
+  SDL_cond *wake;
+  Job job;
+  bool stop;
+  SDL_atomic_t busy;
+  SDL_atomic_t remaining; // chunks of the job that are not done
+  JobQueue queues[MAX_JOB_WORKERS + 1];
+} JobPool;
+
+static JobPool job_pool;
+
+bool takeChunk(JobQueue *const queue, const uint32_t job, const bool steal,
+               int32_t *const chunk) {
+  bool taken = false;
+  SDL_AtomicLock(&queue->lock);
+  if (queue->job == job && queue->next < queue->end) {
+    *chunk = steal ? --queue->end : queue->next++;
+    taken = true;
+  }
+  SDL_AtomicUnlock(&queue->lock);
+  return taken;
+}
+
+void runChunks(const Job *const job, const int32_t worker) {
+  const int32_t workers = job_pool.worker_count + 1;
+  for (;;) {
+    int32_t chunk;
+    bool taken = takeChunk(&job_pool.queues[worker], job->id, false, &chunk);
+    for (int32_t i = 1; !taken && i < workers; i++)
+      taken = takeChunk(&job_pool.queues[(worker + i) % workers], job->id,
+                        true, &chunk);
+    if (!taken)
+      return;
+    const int32_t begin = chunk * job->chunk_size;
+    const int32_t end = begin + job->chunk_size < job->count
+                            ? begin + job->chunk_size
+                            : job->count;
+    job->function(job->data, begin, end, worker);
+    SDL_AtomicAdd(&job_pool.remaining, -1);
+  }
+}
+
+int jobWorker(void *const data) {
+  const int32_t worker = (int32_t)(intptr_t)data;
+  uint32_t seen = 0;
+  SDL_LockMutex(job_pool.mutex);
+  for (;;) {
+    while (!job_pool.stop && job_pool.job.id == seen)
+      SDL_CondWait(job_pool.wake, job_pool.mutex);
+    if (job_pool.stop)
+      break;
+    const Job job = job_pool.job;
+    seen = job.id;
+    SDL_UnlockMutex(job_pool.mutex);
+    runChunks(&job, worker);
+    SDL_LockMutex(job_pool.mutex);
+  }
+  SDL_UnlockMutex(job_pool.mutex);
+  return 0;
+}
+
+// Starts up to workers threads. With 0 workers every loop runs serially.
+void startJobPool(int32_t workers) {
+  job_pool = (JobPool){0};
+#if FOR_WASM
+  workers = 0;
+#endif
+  if (workers <= 0)
+    return;
+  workers = workers > MAX_JOB_WORKERS ? MAX_JOB_WORKERS : workers;
+  job_pool.mutex = SDL_CreateMutex();
+  job_pool.wake = SDL_CreateCond();
+  if (!job_pool.mutex || !job_pool.wake) {
+    SDL_Log("Unable to create the job pool: %s", SDL_GetError());
+    return;
+  }
+  for (int32_t i = 0; i < workers; i++) {
+    job_pool.threads[i] =
+        SDL_CreateThread(jobWorker, "job worker", (void *)(intptr_t)(i + 1));
+    if (!job_pool.threads[i]) {
+      SDL_Log("Unable to start a job worker: %s", SDL_GetError());
+      break;
+    }
+    job_pool.worker_count++;
+  }
+}
+
+void stopJobPool(void) {
+  if (job_pool.mutex) {
+    SDL_LockMutex(job_pool.mutex);
+    job_pool.stop = true;
+    SDL_CondBroadcast(job_pool.wake);
+    SDL_UnlockMutex(job_pool.mutex);
+  }
+  for (int32_t i = 0; i < job_pool.worker_count; i++)
+    SDL_WaitThread(job_pool.threads[i], NULL);
+  if (job_pool.wake)
+    SDL_DestroyCond(job_pool.wake);
+  if (job_pool.mutex)
+    SDL_DestroyMutex(job_pool.mutex);
+  job_pool = (JobPool){0};
+}
+
+// Calls function on chunks of about chunk_size items of [0, count) in
+// parallel and returns when all of them are done.
+void parallelFor(const int32_t count, int32_t chunk_size,
+                 const JobFunction function, void *const data) {
+  chunk_size = (chunk_size + JOB_CHUNK_ALIGNMENT - 1) / JOB_CHUNK_ALIGNMENT *
+               JOB_CHUNK_ALIGNMENT;
+  const int32_t chunks = (count + chunk_size - 1) / chunk_size;
+  if (count < PARALLEL_MIN_ITEMS || chunks < 2 || job_pool.worker_count == 0 ||
+      !SDL_AtomicCAS(&job_pool.busy, 0, 1)) {
+    function(data, 0, count, 0);
+    return;
+  }
+
+  const int32_t workers = job_pool.worker_count + 1;
+  SDL_LockMutex(job_pool.mutex);
+  job_pool.job = (Job){
+      .id = job_pool.job.id + 1,
+      .function = function,
+      .data = data,
+      .count = count,
+      .chunk_size = chunk_size,
+  };
+  SDL_AtomicSet(&job_pool.remaining, chunks);
+  for (int32_t i = 0; i < workers; i++) {
+    JobQueue *const queue = &job_pool.queues[i];
+    SDL_AtomicLock(&queue->lock);
+    queue->job = job_pool.job.id;
+    queue->next = (int64_t)chunks * i / workers;
+    queue->end = (int64_t)chunks * (i + 1) / workers;
+    SDL_AtomicUnlock(&queue->lock);
+  }
+  const Job job = job_pool.job;
+  SDL_CondBroadcast(job_pool.wake);
+  SDL_UnlockMutex(job_pool.mutex);
+
+  runChunks(&job, 0);
+  // The others are finishing their last chunk
+  for (int32_t spins = 0; SDL_AtomicGet(&job_pool.remaining) > 0; spins++) {
+    if (spins < JOB_WAIT_SPINS)
+      CPU_PAUSE();
+    else
+      SDL_Delay(0);
+  }
+  SDL_MemoryBarrierAcquire();
+  SDL_AtomicSet(&job_pool.busy, 0);
+}
+
 typedef struct Projectile_s {
   Vector2D pos;
   Vector2D vel;
@@ -264,43 +1064,61 @@ typedef struct Projectile_s {
 typedef struct Bar_s {
   Vector2D pos;
   int32_t vel;
+  float dx; // distance moved by the last updateBar, less than vel at the walls
 } Bar;
 
-Bar initialBar(void) {
-  return (Bar){.pos = (Vector2D){.x = (float)(uint32_t)BAR_START_X,
-                                 .y = (float)(uint32_t)BAR_START_Y},
+Bar initialBar(const Level *const level) {
+  return (Bar){.pos = (Vector2D){.x = barStartX(level), .y = barStartY(level)},
                .vel = 0};
 }
 
-SDL_Rect createBarRect(const Bar *const bar) {
-  return createSdlRect(bar->pos.x, bar->pos.y, BAR_WIDTH, BAR_HEIGHT);
+SDL_Rect createBarRect(const Bar *const bar, const Level *const level) {
+  return createSdlRect(bar->pos.x, bar->pos.y, level->bar_width,
+                       level->bar_height);
 }
 
-void setBarSpeedDir(Bar *const bar, const int32_t direction) {
-  bar->vel = direction * BAR_SPEED;
+void setBarSpeedDir(Bar *const bar, const Level *const level,
+                    const int32_t direction) {
+  bar->vel = direction * level->bar_speed;
 }
 
-void setBarSpeedLeft(Bar *const bar) { setBarSpeedDir(bar, -1); }
+void setBarSpeedLeft(Bar *const bar, const Level *const level) {
+  setBarSpeedDir(bar, level, -1);
+}
 
-void setBarSpeedRight(Bar *const bar) { setBarSpeedDir(bar, 1); }
+void setBarSpeedRight(Bar *const bar, const Level *const level) {
+  setBarSpeedDir(bar, level, 1);
+}
 
-void updateBar(Bar *const bar) {
+void updateBar(Bar *const bar, const Level *const level) {
   float nx = bar->pos.x + (float)bar->vel * DELTA_TIME_SEC;
-  nx = FCLAMP(nx, 0, WINDOW_WIDTH - BAR_WIDTH);
+  nx = FCLAMP(nx, 0, level->width - level->bar_width);
+  bar->dx = nx - bar->pos.x;
   bar->pos.x = nx;
 }
 
-void drawBar(const Bar *const proj, SDL_Renderer *const renderer) {
-  SDL_Rect rect = createBarRect(proj);
-  SDL_SetRenderDrawColor(renderer, SPREAD_COLOR(BAR_COLOR));
-  SDL_RenderFillRect(renderer, &rect);
+void drawBar(const Bar *const proj, const Level *const level,
+             GeometryBatch *const batch) {
+  const SDL_Rect rect = createBarRect(proj, level);
+  batchRect(batch, &rect, BAR_COLOR);
 }
 
-typedef struct Target_s {
-  Vector2D pos;
-  bool is_alive;
-  color_t color;
-} Target;
+// The position of a target follows from its index and its color from its row,
+// so only one alive bit per target is stored.
+#define TARGET_KILL_LOG_SIZE 64
+
+typedef struct Targets_s {
+  const Level *level;
+  uint64_t *alive; // bit i % 64 of word i / 64 is target i
+  uint32_t alive_count;
+  color_t *row_colors;
+  // The renderer follows the changes of the targets with these: generation
+  // changes when all targets are reinitialized and kill_log[k %
+  // TARGET_KILL_LOG_SIZE] is the k-th killed target since then.
+  uint32_t generation;
+  uint64_t kills;
+  uint32_t kill_log[TARGET_KILL_LOG_SIZE];
+} Targets;
 
 typedef struct LinearColor_s {
   float r;
@@ -313,14 +1131,39 @@ float color_u8_to_f32(const uint8_t x) { return x / 255.0; }
 
 uint8_t color_f32_to_u8(const float x) { return x * 255.0; }
 
-float to_linear(const uint8_t x) {
-  const float f = color_u8_to_f32(x);
-  if (f <= 0.04045)
-    return f / 12.92;
-  else
-    return pow((f + 0.055) / 1.055, 2.4);
+// The sRGB transfer function is tabulated once, so converting a color costs a
+// table lookup instead of a pow per channel. The linear -> sRGB table needs
+// more entries than 256, because the curve is steep near black.
+#define SRGB_TO_LINEAR_LUT_SIZE 256
+#define LINEAR_TO_SRGB_LUT_SIZE 4096
+#define COLOR_LERP_CHUNK 64
+
+static float srgb_to_linear_lut[SRGB_TO_LINEAR_LUT_SIZE];
+static uint8_t linear_to_srgb_lut[LINEAR_TO_SRGB_LUT_SIZE];
+
+void initializeColorTables(void) {
+  for (int i = 0; i < SRGB_TO_LINEAR_LUT_SIZE; i++) {
+    const double f = i / 255.0;
+    srgb_to_linear_lut[i] =
+        f <= 0.04045 ? f / 12.92 : pow((f + 0.055) / 1.055, 2.4);
+  }
+  for (int i = 0; i < LINEAR_TO_SRGB_LUT_SIZE; i++) {
+    const double x = (double)i / (LINEAR_TO_SRGB_LUT_SIZE - 1);
+    const double f =
+        x <= 0.0031308 ? x * 12.92 : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+    linear_to_srgb_lut[i] = lround(f * 255.0);
+  }
+}
+
+float to_linear(const uint8_t x) { return srgb_to_linear_lut[x]; }
+
+int32_t linear_lut_index(const float x) {
+  const float clamped = x < 0 ? 0 : (x > 1 ? 1 : x);
+  return clamped * (LINEAR_TO_SRGB_LUT_SIZE - 1) + 0.5f;
 }
 
+uint8_t to_srgb(const float x) { return linear_to_srgb_lut[linear_lut_index(x)]; }
+
 LinearColor srgb_to_linear(const uint8_t r, const uint8_t g, const uint8_t b,
                            const uint8_t a) {
   return (LinearColor){
@@ -331,12 +1174,6 @@ LinearColor srgb_to_linear(const uint8_t r, const uint8_t g, const uint8_t b,
   };
 }
 
-uint8_t to_srgb(const float x) {
-  const float f =
-      (x <= 0.0031308) ? x * 12.92 : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
-  return color_f32_to_u8(f);
-}
-
 LinearColor lerp_color(const LinearColor *const color1,
                        const LinearColor *const color2, const float t) {
   const float vec1[] = {color1->r, color1->g, color1->b, color1->a};
@@ -365,264 +1202,3193 @@ color_t lerp_color_gamma_corrected(const color_t color1, const color_t color2,
   return linear_to_srgb(&c);
 }
 
-void initializeTargets(Target targets[TARGET_NUMBER]) {
-  const int32_t dx = TARGET_SPACE_WIDTH / TARGET_X_NUMBER;
-  const int32_t dy = TARGET_SPACE_HEIGHT / TARGET_Y_NUMBER;
-  // Shift the targets to the right so that they are centered:
-  const int32_t align_dx = (dx - TARGET_WIDTH) / (TARGET_X_NUMBER - 1);
-  const int32_t align_dy = (dy - TARGET_HEIGHT) / (TARGET_Y_NUMBER - 1);
-
-  const color_t red = 0xFF2E2EFF;
-  const color_t green = 0x2EFF2EFF;
-  const color_t blue = 0x2E2EFFFF;
-  const float level = 0.5;
-
-  for (uint32_t idx = 0; idx < TARGET_NUMBER; idx++) {
-    const uint32_t idx_x = idx % TARGET_X_NUMBER;
-    const uint32_t idx_y = idx / TARGET_X_NUMBER;
-    const uint32_t pos_x = TARGET_X_PADDING + (dx + align_dx) * idx_x;
-    const uint32_t pos_y = TARGET_Y_PADDING + (dy + align_dy) * idx_y;
-
-    const float t = (float)idx_y / TARGET_Y_NUMBER;
-    color_t target_color;
-    if (t < level)
-      target_color = lerp_color_gamma_corrected(red, green, t / level);
-    else
-      target_color =
-          lerp_color_gamma_corrected(green, blue, (t - level) / (1 - level));
-    targets[idx].pos = (Vector2D){
-        .x = pos_x,
-        .y = pos_y,
-    };
-    targets[idx].is_alive = true;
-    targets[idx].color = target_color;
-  }
-}
-
-SDL_Rect createTargetRect(const Target *const target) {
-  return createSdlRect(target->pos.x, target->pos.y, TARGET_WIDTH,
-                       TARGET_HEIGHT);
-}
-
-void drawTargets(const Target targets[TARGET_NUMBER],
-                 SDL_Renderer *const renderer) {
-  for (int i = 0; i < TARGET_NUMBER; i++) {
-    if (targets[i].is_alive) {
-      const SDL_Rect rect = createTargetRect(&targets[i]);
-      SDL_SetRenderDrawColor(renderer, SPREAD_COLOR(targets[i].color));
-      SDL_RenderFillRect(renderer, &rect);
+// Mixes color1 and color2 in linear space for every t[i] and stores the sRGB
+// result in out[i]. The interpolation and the table indices are computed a
+// chunk at a time in separate loops over plain arrays, which the compiler
+// vectorizes, only the table lookups are scalar.
+void lerp_colors_gamma_corrected(const color_t color1, const color_t color2,
+                                 const float *const t, color_t *const out,
+                                 const int32_t n) {
+  const LinearColor c1 = srgb_to_linear(SPREAD_COLOR(color1));
+  const LinearColor c2 = srgb_to_linear(SPREAD_COLOR(color2));
+  const float dr = c2.r - c1.r;
+  const float dg = c2.g - c1.g;
+  const float db = c2.b - c1.b;
+  const float da = c2.a - c1.a;
+  for (int32_t begin = 0; begin < n; begin += COLOR_LERP_CHUNK) {
+    const int32_t count =
+        n - begin < COLOR_LERP_CHUNK ? n - begin : COLOR_LERP_CHUNK;
+    int32_t r[COLOR_LERP_CHUNK];
+    int32_t g[COLOR_LERP_CHUNK];
+    int32_t b[COLOR_LERP_CHUNK];
+    int32_t a[COLOR_LERP_CHUNK];
+    for (int32_t i = 0; i < count; i++) {
+      const float ti = t[begin + i];
+      r[i] = linear_lut_index(c1.r + dr * ti);
+      g[i] = linear_lut_index(c1.g + dg * ti);
+      b[i] = linear_lut_index(c1.b + db * ti);
+      a[i] = (c1.a + da * ti) * 255.0f;
+    }
+    for (int32_t i = 0; i < count; i++) {
+      out[begin + i] =
+          UNSPREAD_COLOR(linear_to_srgb_lut[r[i]], linear_to_srgb_lut[g[i]],
+                         linear_to_srgb_lut[b[i]], (uint32_t)a[i]);
     }
   }
 }
 
-typedef struct Particle_s {
-  Vector2D pos;
-  color_t color;
-  float angle; // between [0,2*pi)
-  int32_t size;
-  int32_t speed;
-  float time_alive_sec; // < 0 indicates not active
-  float max_time_alive_sec;
-} Particle;
-
-void initializeParticle(Particle *const particle) {
-  particle->pos = (Vector2D){0, 0};
-  particle->color = 0xFF4040FF;
-  particle->angle = 0;
-  particle->size = PARTICLE_SIZE;
-  particle->speed = PARTICLE_SPEED;
-  particle->time_alive_sec = -1.0;
-  particle->max_time_alive_sec = PARTICLE_LIFETIME_SEC;
-}
-
-void initializeParticles(Particle particles[PARTICLE_NUMBER]) {
-  for (int i = 0; i < PARTICLE_NUMBER; i++)
-    initializeParticle(&particles[i]);
-}
-
-SDL_Rect createParticleRect(const Particle *particle) {
-  return createSdlRect(particle->pos.x, particle->pos.y, particle->size,
-                       particle->size);
-}
-void updateParticles(Particle particles[PARTICLE_NUMBER]) {
-  for (int i = 0; i < PARTICLE_NUMBER; i++) {
-    if (particles[i].time_alive_sec >= 0) {
-      particles[i].time_alive_sec += DELTA_TIME_SEC;
-      if (particles[i].time_alive_sec >= particles[i].max_time_alive_sec) {
-        initializeParticle(&particles[i]);
-        continue;
-      }
-      particles[i].pos.x += particles[i].speed * cos(particles[i].angle);
-      particles[i].pos.y += particles[i].speed * sin(particles[i].angle);
-      const uint8_t alpha = 0xFF * (1 - particles[i].time_alive_sec /
-                                            particles[i].max_time_alive_sec);
-      const color_t color = SET_ALPHA(particles[i].color, alpha);
-      particles[i].color = color;
+// Fills out with n colors of a gradient through the evenly spaced stops. The
+// color i is taken at i / n, so the last stop itself is never reached.
+void gradient_gamma_corrected(const color_t *const stops,
+                              const int32_t stop_count, color_t *const out,
+                              const int32_t n) {
+  if (stop_count == 1) {
+    for (int32_t i = 0; i < n; i++)
+      out[i] = stops[0];
+    return;
+  }
+  const int32_t segments = stop_count - 1;
+  float t[COLOR_LERP_CHUNK];
+  for (int32_t segment = 0; segment < segments; segment++) {
+    // First color whose position i / n lies in this segment
+    const int32_t first = ((int64_t)segment * n + segments - 1) / segments;
+    const int32_t end = ((int64_t)(segment + 1) * n + segments - 1) / segments;
+    for (int32_t begin = first; begin < end; begin += COLOR_LERP_CHUNK) {
+      const int32_t count =
+          end - begin < COLOR_LERP_CHUNK ? end - begin : COLOR_LERP_CHUNK;
+      for (int32_t i = 0; i < count; i++)
+        t[i] = (float)(begin + i) * segments / n - segment;
+      lerp_colors_gamma_corrected(stops[segment], stops[segment + 1], t,
+                                  &out[begin], count);
     }
   }
 }
 
-void drawParticles(const Particle particles[PARTICLE_NUMBER],
-                   SDL_Renderer *const renderer) {
-  for (int i = 0; i < PARTICLE_NUMBER; i++) {
-    if (particles[i].time_alive_sec >= 0) {
-      const SDL_Rect rect = createParticleRect(&particles[i]);
-      SDL_SetRenderDrawColor(renderer, SPREAD_COLOR(particles[i].color));
-      SDL_RenderFillRect(renderer, &rect);
-    }
+void initializeTargets(Targets *const targets) {
+  const color_t stops[] = {
+      0xFF2E2EFF, // red
+      0x2EFF2EFF, // green
+      0x2E2EFFFF, // blue
+  };
+  const Level *const level = targets->level;
+  gradient_gamma_corrected(stops, sizeof(stops) / sizeof(stops[0]),
+                           targets->row_colors, level->rows);
+
+  targets->generation++;
+  targets->kills = 0;
+  targets->alive_count = 0;
+  for (uint32_t word = 0; word < level->target_words; word++) {
+    const uint32_t remaining = level->target_number - word * 64;
+    targets->alive[word] =
+        remaining >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << remaining) - 1;
+    targets->alive_count += __builtin_popcountll(targets->alive[word]);
   }
 }
 
-void emitParticles(Particle particles[PARTICLE_NUMBER],
-                   const Target *const target) {
-  size_t emitted = 0;
-  const size_t to_emit =
-      PARTICLE_TO_EMIT +
-      (drand48() - 0.5) * (float)(uint32_t)PARTICLE_TO_EMIT_VARIABILITY;
-  for (int i = 0; i < PARTICLE_NUMBER; i++) {
-    if (particles[i].time_alive_sec < 0) {
-      particles[i].time_alive_sec = 0;
-      particles[i].color = target->color;
-      particles[i].max_time_alive_sec +=
-          (drand48() - 0.5) * PARTICLE_LIFETIME_SEC_VARIABILITY;
-      particles[i].speed += (drand48() - 0.5) * PARTICLE_SPEED_VARIABILITY;
-      particles[i].size += (drand48() - 0.5) * PARTICLE_SIZE_VARIABLILIY;
-      particles[i].pos.x =
-          target->pos.x + TARGET_WIDTH / 2.0 - particles[i].size / 2.0;
-      particles[i].pos.y =
-          target->pos.y + TARGET_HEIGHT / 2.0 - particles[i].size / 2.0;
-      particles[i].angle = drand48() * 2 * M_PI;
-      emitted += 1;
-      if (emitted >= to_emit) {
-        break;
-      }
-    }
-  }
+bool isTargetAlive(const Targets *const targets, const uint32_t idx) {
+  return (targets->alive[idx / 64] >> (idx % 64)) & 1;
 }
 
-void updateProj(Projectile *const proj, Target targets[TARGET_NUMBER],
-                Particle particles[PARTICLE_NUMBER], const Bar *const bar,
-                uint64_t *const score) {
-  const Vector2D n_speed = vecMult(&proj->vel, DELTA_TIME_SEC);
-  const Vector2D n_pos = addVec(&proj->pos, &n_speed);
-  const SDL_Rect barRect = createBarRect(bar);
-  const SDL_Rect projRect_x =
-      createSdlRect(n_pos.x, proj->pos.y, PROJ_WIDTH, PROJ_HEIGHT);
-  const SDL_Rect projRect_y =
-      createSdlRect(proj->pos.x, n_pos.y, PROJ_WIDTH, PROJ_HEIGHT);
-
-  bool intersects_target_x = false;
-  bool intersects_target_y = false;
-  for (int i = 0; i < TARGET_NUMBER; i++) {
-    if (targets[i].is_alive) {
-      const SDL_Rect targetRect = createTargetRect(&targets[i]);
-      intersects_target_x = SDL_HasIntersection(&targetRect, &projRect_x) != 0;
-      intersects_target_y = SDL_HasIntersection(&targetRect, &projRect_y) != 0;
-      if (intersects_target_x || intersects_target_y) {
-        targets[i].is_alive = false;
-        (*score) += TARGET_SCORE;
-        emitParticles(particles, &targets[i]);
-        break;
-      }
-    }
-  }
+void killTarget(Targets *const targets, const uint32_t idx) {
+  targets->alive[idx / 64] &= ~(UINT64_C(1) << (idx % 64));
+  targets->alive_count--;
+  targets->kill_log[targets->kills++ % TARGET_KILL_LOG_SIZE] = idx;
+}
 
-  const bool intersects_bar_x = SDL_HasIntersection(&barRect, &projRect_x) != 0;
-  if (n_pos.x < 0 || n_pos.x + PROJ_WIDTH > WINDOW_WIDTH || intersects_bar_x ||
-      intersects_target_x) {
-    proj->vel.x = -proj->vel.x;
-  }
-  const bool intersects_bar_y = SDL_HasIntersection(&barRect, &projRect_y) != 0;
-  if (n_pos.y < 0 || n_pos.y + PROJ_HEIGHT > WINDOW_HEIGHT ||
-      intersects_bar_y || intersects_target_y) {
-    proj->vel.y = -proj->vel.y;
-  }
-  if (intersects_bar_y) {
-    if (abs(bar->vel) > 0) {
-      proj->vel.x = SIGN(bar->vel) * fabs(proj->vel.x);
-    }
-  }
-  const Vector2D speed_updated = vecMult(&proj->vel, DELTA_TIME_SEC);
-  addToVec(&proj->pos, &speed_updated);
+Vector2D targetPos(const Level *const level, const uint32_t idx) {
+  return (Vector2D){
+      .x = level->target_x_padding + TARGET_X_PITCH * (idx % level->cols),
+      .y = level->target_y_padding + TARGET_Y_PITCH * (idx / level->cols),
+  };
 }
 
-bool hasLost(const Projectile *const proj) {
-  const Vector2D speed = vecMult(&proj->vel, DELTA_TIME_SEC);
-  const Vector2D n_pos = addVec(&proj->pos, &speed);
-  return n_pos.y + PROJ_WIDTH > WINDOW_HEIGHT;
+color_t targetColor(const Targets *const targets, const uint32_t idx) {
+  return targets->row_colors[idx / targets->level->cols];
 }
 
-bool hasWon(Target targets[TARGET_NUMBER]) {
-  for (int i = 0; i < TARGET_NUMBER; i++) {
-    if (targets[i].is_alive) {
-      return false;
-    }
-  }
-  return true;
+SDL_Rect createTargetRect(const Level *const level, const uint32_t idx) {
+  const Vector2D pos = targetPos(level, idx);
+  return createSdlRect(pos.x, pos.y, TARGET_WIDTH, TARGET_HEIGHT);
 }
 
-Projectile initialProj() {
+// The targets lie on a regular lattice, so the targets that can overlap a
+// rectangle are found directly from its coordinates instead of testing all of
+// them. The ranges are inclusive and empty if x0 > x1 or y0 > y1.
+typedef struct TargetCells_s {
+  int32_t x0;
+  int32_t x1;
+  int32_t y0;
+  int32_t y1;
+} TargetCells;
+
+int32_t floorDiv(const int32_t a, const int32_t b) {
+  const int32_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Cells c with padding + c * pitch < hi and padding + c * pitch + size > lo.
+void targetCellRange(const int32_t lo, const int32_t hi, const int32_t padding,
+                     const int32_t pitch, const int32_t size,
+                     const int32_t count, int32_t *const first,
+                     int32_t *const last) {
+  *first = floorDiv(lo - padding - size, pitch) + 1;
+  *last = floorDiv(hi - padding - 1, pitch);
+  if (*first < 0)
+    *first = 0;
+  if (*last > count - 1)
+    *last = count - 1;
+}
+
+TargetCells targetCellsInRect(const Level *const level,
+                              const SDL_Rect *const rect) {
+  TargetCells cells;
+  targetCellRange(rect->x, rect->x + rect->w, level->target_x_padding,
+                  TARGET_X_PITCH, TARGET_WIDTH, level->cols, &cells.x0,
+                  &cells.x1);
+  targetCellRange(rect->y, rect->y + rect->h, level->target_y_padding,
+                  TARGET_Y_PITCH, TARGET_HEIGHT, level->rows, &cells.y0,
+                  &cells.y1);
+  return cells;
+}
+
+void drawTargets(const Targets *const targets, GeometryBatch *const batch) {
+  TRACE_ZONE("drawTargets");
+  const Level *const level = targets->level;
+  for (uint32_t word = 0; word < level->target_words; word++) {
+    for (uint64_t bits = targets->alive[word]; bits; bits &= bits - 1) {
+      const uint32_t idx = word * 64 + __builtin_ctzll(bits);
+      const SDL_Rect rect = createTargetRect(level, idx);
+      batchRect(batch, &rect, targetColor(targets, idx));
+    }
+  }
+}
+
+// The targets only change when one is killed, so they are rendered once into
+// a texture that is copied to the screen every frame. A kill only clears the
+// rectangle of the killed target in the texture.
+typedef struct TargetLayer_s {
+  SDL_Texture *texture; // NULL if render targets are not supported
+  bool valid;
+  uint32_t generation;
+  uint64_t kills_seen;
+} TargetLayer;
+
+void createTargetLayer(TargetLayer *const layer, SDL_Renderer *const renderer) {
+  *layer = (TargetLayer){0};
+  layer->texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                        SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+  if (!layer->texture) {
+    SDL_Log("Unable to create the target layer, drawing targets directly: %s",
+            SDL_GetError());
+    return;
+  }
+  SDL_SetTextureBlendMode(layer->texture, SDL_BLENDMODE_BLEND);
+}
+
+void destroyTargetLayer(TargetLayer *const layer) {
+  if (layer->texture)
+    SDL_DestroyTexture(layer->texture);
+  *layer = (TargetLayer){0};
+}
+
+// Brings the texture up to date with the targets. batch must be empty.
+void updateTargetLayer(TargetLayer *const layer, const Targets *const targets,
+                       SDL_Renderer *const renderer,
+                       GeometryBatch *const batch) {
+  const bool rebuild = !layer->valid ||
+                       layer->generation != targets->generation ||
+                       targets->kills - layer->kills_seen > TARGET_KILL_LOG_SIZE;
+  if (!rebuild && layer->kills_seen == targets->kills)
+    return;
+
+  SDL_SetRenderTarget(renderer, layer->texture);
+  // The texture has the size of the window, not of the world
+  const float scale = 1 / targets->level->scale;
+  SDL_RenderSetScale(renderer, scale, scale);
+  if (rebuild) {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    drawTargets(targets, batch);
+  } else {
+    for (uint64_t k = layer->kills_seen; k < targets->kills; k++) {
+      const SDL_Rect rect = createTargetRect(
+          targets->level, targets->kill_log[k % TARGET_KILL_LOG_SIZE]);
+      batchRect(batch, &rect, 0x00000000);
+    }
+  }
+  submitBatch(batch);
+  SDL_SetRenderTarget(renderer, NULL);
+
+  layer->valid = true;
+  layer->generation = targets->generation;
+  layer->kills_seen = targets->kills;
+}
+
+// Particles are stored as a structure of arrays, such that the update is a
+// straight vectorized pass over aligned float arrays. The velocity is computed
+// once when a particle is emitted instead of calling cos and sin every frame.
+// The live particles are packed into [0, count): emitting appends and an
+// expired particle is replaced by the last one, so updating and drawing only
+// touch live particles.
+#define PARTICLE_INACTIVE -1.0f
+
+// Every game has its own random state, so games can run side by side. It is
+// kept with the particles, which draw most of the numbers, and in headless
+// runs also places the serve of every round (see placeServe). The generator is
+// PCG32 (XSH RR) seeded like pcg32_srandom_r(seed, RANDOM_STREAM) of the
+// reference implementation. zigout.zig has the same generator, so both games
+// draw the same numbers for the same seed, independent of the libc.
+#define DEFAULT_SEED 0x1234ABCD
+#define RANDOM_STREAM 54
+#define RANDOM_MULTIPLIER 6364136223846793005ULL
+#define RANDOM_LANES 8
+
+typedef struct Random_s {
+  uint64_t state;
+  uint64_t increment; // odd, selects the stream
+} Random;
+
+static inline uint32_t randomOutput(const uint64_t state) {
+  const uint32_t xorshifted = ((state >> 18) ^ state) >> 27;
+  const uint32_t rotation = state >> 59;
+  return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+static inline float randomToFloat(const uint32_t bits) {
+  return (bits >> 8) * 0x1p-24f; // 24 bits fill the mantissa exactly
+}
+
+uint32_t randomNext(Random *const random) {
+  const uint64_t state = random->state;
+  random->state = state * RANDOM_MULTIPLIER + random->increment;
+  return randomOutput(state);
+}
+
+Random seededRandom(const uint64_t seed) {
+  Random random = {.state = 0, .increment = (RANDOM_STREAM << 1) | 1};
+  randomNext(&random);
+  random.state += seed;
+  randomNext(&random);
+  return random;
+}
+
+// Returns a number in [0, 1)
+float randomFloat(Random *const random) {
+  return randomToFloat(randomNext(random));
+}
+
+// Fills out with the next n numbers in [0, 1), the same as n calls of
+// randomFloat. The sequence is split into RANDOM_LANES interleaved lanes that
+// jump RANDOM_LANES steps at once, so the lanes do not wait for each other.
+void randomFill(Random *const random, float *const out, const int32_t n) {
+  int32_t i = 0;
+  if (n >= 2 * RANDOM_LANES) {
+    // state after RANDOM_LANES steps = jump_multiplier * state + jump_increment
+    uint64_t jump_multiplier = 1;
+    uint64_t jump_increment = 0;
+    uint64_t lanes[RANDOM_LANES];
+    for (int32_t lane = 0; lane < RANDOM_LANES; lane++) {
+      lanes[lane] = lane ? lanes[lane - 1] * RANDOM_MULTIPLIER +
+                               random->increment
+                         : random->state;
+      jump_multiplier *= RANDOM_MULTIPLIER;
+      jump_increment = jump_increment * RANDOM_MULTIPLIER + random->increment;
+    }
+    for (; i + RANDOM_LANES <= n; i += RANDOM_LANES) {
+      for (int32_t lane = 0; lane < RANDOM_LANES; lane++) {
+        out[i + lane] = randomToFloat(randomOutput(lanes[lane]));
+        lanes[lane] = lanes[lane] * jump_multiplier + jump_increment;
+      }
+    }
+    random->state = lanes[0];
+  }
+  for (; i < n; i++)
+    out[i] = randomFloat(random);
+}
+
+// The float arrays are ARENA_ALIGNMENT aligned
+typedef struct Particles_s {
+  Random random; // not touched by a reset of the level
+  int32_t quality; // level of the quality governor, 0 is full quality
+  int32_t count;
+  int32_t capacity;
+  float *x;
+  float *y;
+  float *vx; // per frame
+  float *vy;
+  float *age; // < 0 after it expired
+  float *inv_lifetime;
+  float *alpha; // linear fade in [0, 1]
+  int32_t *size;
+  color_t *color;
+} Particles;
+
+#define PARTICLE_ARRAYS 9
+
+bool allocateParticles(Particles *const p, Arena *const arena,
+                       const int32_t capacity) {
+  const size_t bytes = sizeof(float) * capacity;
+  p->capacity = capacity;
+  p->x = arenaAlloc(arena, bytes);
+  p->y = arenaAlloc(arena, bytes);
+  p->vx = arenaAlloc(arena, bytes);
+  p->vy = arenaAlloc(arena, bytes);
+  p->age = arenaAlloc(arena, bytes);
+  p->inv_lifetime = arenaAlloc(arena, bytes);
+  p->alpha = arenaAlloc(arena, bytes);
+  p->size = arenaAlloc(arena, sizeof(int32_t) * capacity);
+  p->color = arenaAlloc(arena, sizeof(color_t) * capacity);
+  return p->x && p->y && p->vx && p->vy && p->age && p->inv_lifetime &&
+         p->alpha && p->size && p->color;
+}
+
+void initializeParticles(Particles *const particles) { particles->count = 0; }
+
+void removeParticle(Particles *const p, const int32_t i) {
+  const int32_t last = --p->count;
+  p->x[i] = p->x[last];
+  p->y[i] = p->y[last];
+  p->vx[i] = p->vx[last];
+  p->vy[i] = p->vy[last];
+  p->age[i] = p->age[last];
+  p->inv_lifetime[i] = p->inv_lifetime[last];
+  p->alpha[i] = p->alpha[last];
+  p->size[i] = p->size[last];
+  p->color[i] = p->color[last];
+}
+
+SDL_Rect createParticleRect(const Particles *const particles, const int i) {
+  return createSdlRect(particles->x[i], particles->y[i], particles->size[i],
+                       particles->size[i]);
+}
+
+void updateParticleRangeScalar(Particles *const p, const int32_t begin,
+                               const int32_t end) {
+  for (int32_t i = begin; i < end; i++) {
+    if (p->age[i] < 0)
+      continue;
+    const float next_age = p->age[i] + DELTA_TIME_SEC;
+    const float left = 1.0f - next_age * p->inv_lifetime[i];
+    if (left > 0) {
+      p->age[i] = next_age;
+      p->x[i] += p->vx[i];
+      p->y[i] += p->vy[i];
+      p->alpha[i] = left;
+    } else {
+      p->age[i] = PARTICLE_INACTIVE;
+      p->alpha[i] = 0;
+    }
+  }
+}
+
+// Advances age, position and alpha of the particles in [begin, end) and marks
+// expired ones as inactive. begin must be a multiple of the vector width (8
+// floats with AVX, 4 with SSE2), the remainder after the last full vector is
+// done by the scalar loop.
+void updateParticleRange(Particles *const p, const int32_t begin,
+                         const int32_t end) {
+  int32_t i = begin;
+#if defined(__AVX__)
+  const __m256 dt = _mm256_set1_ps(DELTA_TIME_SEC);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 inactive = _mm256_set1_ps(PARTICLE_INACTIVE);
+  for (; i + 8 <= end; i += 8) {
+    const __m256 age = _mm256_load_ps(&p->age[i]);
+    const __m256 active = _mm256_cmp_ps(age, zero, _CMP_GE_OQ);
+    const __m256 next_age = _mm256_add_ps(age, dt);
+    const __m256 left = _mm256_sub_ps(
+        one, _mm256_mul_ps(next_age, _mm256_load_ps(&p->inv_lifetime[i])));
+    const __m256 alive =
+        _mm256_and_ps(active, _mm256_cmp_ps(left, zero, _CMP_GT_OQ));
+    _mm256_store_ps(&p->age[i],
+                    _mm256_blendv_ps(_mm256_blendv_ps(age, inactive, active),
+                                     next_age, alive));
+    _mm256_store_ps(&p->x[i],
+                    _mm256_add_ps(_mm256_load_ps(&p->x[i]),
+                                  _mm256_and_ps(_mm256_load_ps(&p->vx[i]),
+                                                alive)));
+    _mm256_store_ps(&p->y[i],
+                    _mm256_add_ps(_mm256_load_ps(&p->y[i]),
+                                  _mm256_and_ps(_mm256_load_ps(&p->vy[i]),
+                                                alive)));
+    _mm256_store_ps(&p->alpha[i], _mm256_and_ps(left, alive));
+  }
+#elif defined(__SSE2__)
+  const __m128 dt = _mm_set1_ps(DELTA_TIME_SEC);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 inactive = _mm_set1_ps(PARTICLE_INACTIVE);
+  for (; i + 4 <= end; i += 4) {
+    const __m128 age = _mm_load_ps(&p->age[i]);
+    const __m128 active = _mm_cmpge_ps(age, zero);
+    const __m128 next_age = _mm_add_ps(age, dt);
+    const __m128 left =
+        _mm_sub_ps(one, _mm_mul_ps(next_age, _mm_load_ps(&p->inv_lifetime[i])));
+    const __m128 alive = _mm_and_ps(active, _mm_cmpgt_ps(left, zero));
+    // alive ? next_age : (active ? inactive : age)
+    const __m128 dead_age =
+        _mm_or_ps(_mm_and_ps(active, inactive), _mm_andnot_ps(active, age));
+    _mm_store_ps(&p->age[i], _mm_or_ps(_mm_and_ps(alive, next_age),
+                                       _mm_andnot_ps(alive, dead_age)));
+    _mm_store_ps(&p->x[i], _mm_add_ps(_mm_load_ps(&p->x[i]),
+                                      _mm_and_ps(_mm_load_ps(&p->vx[i]), alive)));
+    _mm_store_ps(&p->y[i], _mm_add_ps(_mm_load_ps(&p->y[i]),
+                                      _mm_and_ps(_mm_load_ps(&p->vy[i]), alive)));
+    _mm_store_ps(&p->alpha[i], _mm_and_ps(left, alive));
+  }
+#endif
+  updateParticleRangeScalar(p, i, end);
+}
+
+#define PARTICLE_CHUNK 4096 // particles per job chunk
+
+typedef struct ParticleUpdateJob_s {
+  Particles *particles;
+  JobCounter expired[MAX_JOB_WORKERS + 1];
+} ParticleUpdateJob;
+
+void updateParticleChunk(void *const data, const int32_t begin,
+                         const int32_t end, const int32_t worker) {
+  ParticleUpdateJob *const job = data;
+  Particles *const p = job->particles;
+  updateParticleRange(p, begin, end);
+  int32_t expired = 0;
+  for (int32_t i = begin; i < end; i++)
+    expired += p->age[i] < 0;
+  job->expired[worker].value += expired;
+}
+
+void updateParticles(Particles *const particles) {
+  TRACE_ZONE("updateParticles");
+  ParticleUpdateJob job = {.particles = particles};
+  parallelFor(particles->count, PARTICLE_CHUNK, updateParticleChunk, &job);
+  int32_t expired = 0;
+  for (int32_t w = 0; w <= MAX_JOB_WORKERS; w++)
+    expired += job.expired[w].value;
+  for (int32_t i = 0; expired > 0 && i < particles->count;) {
+    if (particles->age[i] < 0) {
+      removeParticle(particles, i);
+      expired--;
+    } else {
+      i++;
+    }
+  }
+}
+
+typedef struct ParticleVertexJob_s {
+  const Particles *particles;
+  int32_t first;        // particle of the first quad
+  SDL_Vertex *vertices; // 4 per particle
+} ParticleVertexJob;
+
+void buildParticleVertices(void *const data, const int32_t begin,
+                           const int32_t end, const int32_t worker) {
+  (void)worker;
+  const ParticleVertexJob *const job = data;
+  for (int32_t i = begin; i < end; i++) {
+    const int32_t particle = job->first + i;
+    const SDL_Rect rect = createParticleRect(job->particles, particle);
+    // The fade is linear in light, SDL blends in sRGB, so encode it
+    const uint8_t alpha = to_srgb(job->particles->alpha[particle]);
+    writeQuad(&job->vertices[4 * i], &rect,
+              SET_ALPHA(job->particles->color[particle], alpha));
+  }
+}
+
+void drawParticles(const Particles *const particles,
+                   GeometryBatch *const batch) {
+  TRACE_ZONE("drawParticles");
+  for (int32_t first = 0; first < particles->count;) {
+    if (batch->quads >= batch->capacity)
+      submitBatch(batch);
+    const int32_t left = particles->count - first;
+    const int32_t space = batch->capacity - batch->quads;
+    const int32_t quads = left < space ? left : space;
+    ParticleVertexJob job = {
+        .particles = particles,
+        .first = first,
+        .vertices = &batch->vertices[4 * batch->quads],
+    };
+    parallelFor(quads, PARTICLE_CHUNK, buildParticleVertices, &job);
+    batch->quads += quads;
+    first += quads;
+  }
+}
+
+// The part of the particles that is emitted and their lifetime for every level
+// of the quality governor
+#define QUALITY_LEVELS 5
+static const float QUALITY_EMITTED[QUALITY_LEVELS] = {1.0f, 0.7f, 0.5f, 0.3f,
+                                                      0.15f};
+static const float QUALITY_LIFETIME[QUALITY_LEVELS] = {1.0f, 0.8f, 0.65f, 0.5f,
+                                                       0.4f};
+
+void emitParticles(Particles *const particles, const Vector2D *const pos,
+                   const color_t color) {
+  TRACE_ZONE("emitParticles");
+  Random *const random = &particles->random;
+  const int32_t drawn =
+      PARTICLE_TO_EMIT +
+      (int32_t)((randomFloat(random) - 0.5f) * PARTICLE_TO_EMIT_VARIABILITY);
+  // Four numbers per particle. They are drawn even if the pool is full or the
+  // quality is lowered, so the sequence does not depend on either.
+  float numbers[4 * (PARTICLE_TO_EMIT + PARTICLE_TO_EMIT_VARIABILITY)];
+  randomFill(random, numbers, 4 * drawn);
+  const int32_t to_emit = drawn * QUALITY_EMITTED[particles->quality] + 0.5f;
+  const float lifetime_scale = QUALITY_LIFETIME[particles->quality];
+  for (int32_t emitted = 0;
+       emitted < to_emit && particles->count < particles->capacity;
+       emitted++) {
+    const float *const u = &numbers[4 * emitted];
+    const int32_t i = particles->count++;
+    const float lifetime =
+        (PARTICLE_LIFETIME_SEC +
+         (u[0] - 0.5f) * PARTICLE_LIFETIME_SEC_VARIABILITY) *
+        lifetime_scale;
+    const int32_t speed =
+        PARTICLE_SPEED + (u[1] - 0.5f) * PARTICLE_SPEED_VARIABILITY;
+    const int32_t size =
+        PARTICLE_SIZE + (u[2] - 0.5f) * PARTICLE_SIZE_VARIABLILIY;
+    const float angle = u[3] * 2 * M_PI; // between [0,2*pi)
+    particles->age[i] = 0;
+    particles->inv_lifetime[i] = 1.0f / lifetime;
+    particles->alpha[i] = 1.0f;
+    particles->color[i] = color;
+    particles->size[i] = size;
+    particles->x[i] = pos->x + TARGET_WIDTH / 2.0 - size / 2.0;
+    particles->y[i] = pos->y + TARGET_HEIGHT / 2.0 - size / 2.0;
+    particles->vx[i] = speed * cosf(angle);
+    particles->vy[i] = speed * sinf(angle);
+  }
+}
+
+// The projectile is moved with continuous collision detection: the time of
+// impact with the walls, the bar and the targets is computed from the swept
+// rectangle, the projectile is advanced to the earliest contact, reflected and
+// the rest of the step is simulated the same way. This way it cannot tunnel
+// through targets or the bar at high speeds and corner hits reflect both axes.
+#define PROJ_MAX_CONTACTS 4
+#define PROJ_MAX_HITS_PER_CONTACT 4
+#define TOI_EPSILON 1e-5f
+
+typedef struct SweptHit_s {
+  float toi;    // fraction of the displacement in [0, 1]
+  int32_t nx;   // surface normal, -1, 0 or 1
+  int32_t ny;
+} SweptHit;
+
+// Sweeps the rectangle at pos with size (w, h) by d against box.
+bool sweepRect(const Vector2D *const pos, const float w, const float h,
+               const Vector2D *const d, const SDL_FRect *const box,
+               SweptHit *const hit) {
+  float entry_x = -INFINITY;
+  float exit_x = INFINITY;
+  if (d->x > 0) {
+    entry_x = (box->x - (pos->x + w)) / d->x;
+    exit_x = (box->x + box->w - pos->x) / d->x;
+  } else if (d->x < 0) {
+    entry_x = (box->x + box->w - pos->x) / d->x;
+    exit_x = (box->x - (pos->x + w)) / d->x;
+  } else if (pos->x + w <= box->x || pos->x >= box->x + box->w) {
+    return false;
+  }
+
+  float entry_y = -INFINITY;
+  float exit_y = INFINITY;
+  if (d->y > 0) {
+    entry_y = (box->y - (pos->y + h)) / d->y;
+    exit_y = (box->y + box->h - pos->y) / d->y;
+  } else if (d->y < 0) {
+    entry_y = (box->y + box->h - pos->y) / d->y;
+    exit_y = (box->y - (pos->y + h)) / d->y;
+  } else if (pos->y + h <= box->y || pos->y >= box->y + box->h) {
+    return false;
+  }
+
+  const float entry = fmaxf(entry_x, entry_y);
+  const float exit = fminf(exit_x, exit_y);
+  if (entry >= exit || exit <= 0 || entry > 1 || isinf(entry))
+    return false;
+
+  hit->toi = fmaxf(entry, 0);
+  // The axis that starts overlapping last is the one that is hit, both if
+  // they start at the same time (corner).
+  hit->nx = d->x != 0 && entry_x >= entry_y - TOI_EPSILON ? -SIGN(d->x) : 0;
+  hit->ny = d->y != 0 && entry_y >= entry_x - TOI_EPSILON ? -SIGN(d->y) : 0;
+  return true;
+}
+
+// Keeps the earliest hit, merging the normals of hits at the same time.
+// Returns 1 if hit replaced best, 0 if it was merged and -1 if it is later.
+int32_t mergeHit(SweptHit *const best, const SweptHit *const hit) {
+  if (hit->toi < best->toi - TOI_EPSILON) {
+    *best = *hit;
+    return 1;
+  }
+  if (hit->toi <= best->toi + TOI_EPSILON) {
+    best->nx = best->nx ? best->nx : hit->nx;
+    best->ny = best->ny ? best->ny : hit->ny;
+    return 0;
+  }
+  return -1;
+}
+
+void sweepWalls(const Level *const level, const Vector2D *const pos,
+                const Vector2D *const d, SweptHit *const best) {
+  SweptHit hit = {0};
+  if (d->x < 0 && pos->x + d->x < 0) {
+    hit = (SweptHit){.toi = fmaxf(pos->x / -d->x, 0), .nx = 1};
+    mergeHit(best, &hit);
+  } else if (d->x > 0 && pos->x + level->proj_width + d->x > level->width) {
+    hit = (SweptHit){
+        .toi = fmaxf((level->width - level->proj_width - pos->x) / d->x, 0),
+        .nx = -1};
+    mergeHit(best, &hit);
+  }
+  if (d->y < 0 && pos->y + d->y < 0) {
+    hit = (SweptHit){.toi = fmaxf(pos->y / -d->y, 0), .ny = 1};
+    mergeHit(best, &hit);
+  } else if (d->y > 0 && pos->y + level->proj_height + d->y > level->height) {
+    hit = (SweptHit){
+        .toi = fmaxf((level->height - level->proj_height - pos->y) / d->y, 0),
+        .ny = -1};
+    mergeHit(best, &hit);
+  }
+}
+
+void updateProj(Projectile *const proj, Targets *const targets,
+                Particles *const particles, const Bar *const bar,
+                uint64_t *const score) {
+  TRACE_ZONE("updateProj");
+  const Level *const level = targets->level;
+  // The bar has already been moved for this frame, sweep against its motion
+  const float bar_dx = bar->dx;
+  float elapsed = 0; // fraction of the frame that has been simulated
+
+  for (int32_t contact = 0; contact < PROJ_MAX_CONTACTS && elapsed < 1;
+       contact++) {
+    const float remaining = 1 - elapsed;
+    const Vector2D d = vecMult(&proj->vel, DELTA_TIME_SEC * remaining);
+    SweptHit best = {.toi = INFINITY};
+    SweptHit hit;
+
+    sweepWalls(level, &proj->pos, &d, &best);
+
+    // The bar is swept in its own frame of reference
+    bool hits_bar = false;
+    const SDL_FRect bar_box = {
+        .x = bar->pos.x - bar_dx * remaining,
+        .y = bar->pos.y,
+        .w = level->bar_width,
+        .h = level->bar_height,
+    };
+    const Vector2D bar_relative_d = {.x = d.x - bar_dx * remaining, .y = d.y};
+    if (sweepRect(&proj->pos, level->proj_width, level->proj_height,
+                  &bar_relative_d, &bar_box, &hit)) {
+      const int32_t merged = mergeHit(&best, &hit);
+      hits_bar = merged >= 0;
+    }
+
+    uint32_t hit_targets[PROJ_MAX_HITS_PER_CONTACT];
+    int32_t hit_count = 0;
+    const SDL_Rect swept = createSdlRect(
+        floorf(fminf(proj->pos.x, proj->pos.x + d.x)),
+        floorf(fminf(proj->pos.y, proj->pos.y + d.y)),
+        ceilf(fabsf(d.x)) + level->proj_width + 1,
+        ceilf(fabsf(d.y)) + level->proj_height + 1);
+    const TargetCells cells = targetCellsInRect(level, &swept);
+    for (int32_t y = cells.y0; y <= cells.y1; y++) {
+      for (int32_t x = cells.x0; x <= cells.x1; x++) {
+        const uint32_t idx = y * level->cols + x;
+        if (!isTargetAlive(targets, idx))
+          continue;
+        const Vector2D target_pos = targetPos(level, idx);
+        const SDL_FRect box = {
+            .x = target_pos.x,
+            .y = target_pos.y,
+            .w = TARGET_WIDTH,
+            .h = TARGET_HEIGHT,
+        };
+        if (!sweepRect(&proj->pos, level->proj_width, level->proj_height, &d,
+                       &box, &hit))
+          continue;
+        const int32_t merged = mergeHit(&best, &hit);
+        if (merged > 0) {
+          hits_bar = false;
+          hit_count = 0;
+        }
+        if (merged >= 0 && hit_count < PROJ_MAX_HITS_PER_CONTACT)
+          hit_targets[hit_count++] = idx;
+      }
+    }
+
+    if (isinf(best.toi)) {
+      addToVec(&proj->pos, &d);
+      break;
+    }
+
+    const Vector2D to_contact = vecMult(&d, best.toi);
+    addToVec(&proj->pos, &to_contact);
+    elapsed += remaining * best.toi;
+
+    if (best.nx)
+      proj->vel.x = best.nx * fabsf(proj->vel.x);
+    if (best.ny)
+      proj->vel.y = best.ny * fabsf(proj->vel.y);
+    if (hits_bar && best.ny && bar_dx != 0)
+      proj->vel.x = SIGN(bar_dx) * fabsf(proj->vel.x);
+
+    for (int32_t i = 0; i < hit_count; i++) {
+      killTarget(targets, hit_targets[i]);
+      (*score) += TARGET_SCORE;
+      const Vector2D pos = targetPos(level, hit_targets[i]);
+      emitParticles(particles, &pos, targetColor(targets, hit_targets[i]));
+    }
+  }
+}
+
+bool hasLost(const Projectile *const proj, const Level *const level) {
+  const Vector2D speed = vecMult(&proj->vel, DELTA_TIME_SEC);
+  const Vector2D n_pos = addVec(&proj->pos, &speed);
+  return n_pos.y + level->proj_height > level->height;
+}
+
+bool hasWon(const Targets *const targets) { return targets->alive_count == 0; }
+
+Projectile initialProj(const Level *const level) {
   return (Projectile){
       .pos =
           (Vector2D){
-              .x = (float)(uint32_t)BAR_START_X + BAR_WIDTH / 2.0 -
-                   PROJ_WIDTH / 2.0,
-              .y = (float)(uint32_t)BAR_START_Y - PROJ_HEIGHT,
+              .x = barStartX(level) + level->bar_width / 2.0 -
+                   level->proj_width / 2.0,
+              .y = barStartY(level) - level->proj_height,
           },
       .vel =
           (Vector2D){
-              .x = PROJ_SPEED,
-              .y = -PROJ_SPEED,
+              .x = level->proj_speed,
+              .y = -level->proj_speed,
           },
   };
 }
 
-SDL_Rect createProjRect(const Projectile *const proj) {
-  return createSdlRect(proj->pos.x, proj->pos.y, PROJ_WIDTH, PROJ_HEIGHT);
+SDL_Rect createProjRect(const Projectile *const proj,
+                        const Level *const level) {
+  return createSdlRect(proj->pos.x, proj->pos.y, level->proj_width,
+                       level->proj_height);
+}
+
+void drawProj(const Projectile *const proj, const Level *const level,
+              GeometryBatch *const batch) {
+  const SDL_Rect rect = createProjRect(proj, level);
+  batchRect(batch, &rect, PROJ_COLOR);
+}
+
+/******* MULTI BALL ********/
+
+// In multi-ball mode a ball that falls out at the bottom is removed and the
+// game is lost with the last ball. Contacts between balls are found with sweep
+// and prune: the balls are kept sorted by x (insertion sort, which is close to
+// linear because the order barely changes between frames) and only balls whose
+// x ranges overlap are tested. Against the targets every ball is swept on its
+// own: the lattice already yields the few cells under its path from its
+// coordinates, so grouping the balls by cell would only add work.
+#define MAX_BALLS 4096
+#define BALL_SPAWN_GAP 4
+
+typedef struct Balls_s {
+  int32_t count;
+  int32_t capacity;
+  Projectile *proj;
+  int32_t *order; // ball indices sorted by pos.x
+  // Positions in sorted order, such that the sweep reads contiguous memory:
+  float *sorted_x;
+  float *sorted_y;
+} Balls;
+
+#define BALL_ARRAYS 4
+
+bool allocateBalls(Balls *const balls, Arena *const arena,
+                   const int32_t capacity) {
+  balls->capacity = capacity;
+  balls->proj = arenaAlloc(arena, sizeof(Projectile) * capacity);
+  balls->order = arenaAlloc(arena, sizeof(int32_t) * capacity);
+  balls->sorted_x = arenaAlloc(arena, sizeof(float) * capacity);
+  balls->sorted_y = arenaAlloc(arena, sizeof(float) * capacity);
+  return balls->proj && balls->order && balls->sorted_x && balls->sorted_y;
+}
+
+void initializeBalls(Balls *const balls, const Level *const level,
+                     int32_t count) {
+  count = count < 1 ? 1 : (count > balls->capacity ? balls->capacity : count);
+  balls->count = count;
+  balls->proj[0] = initialProj(level);
+  balls->order[0] = 0;
+
+  // The other balls start on a lattice between the targets and the bar. If
+  // there are more balls than lattice slots, they are stacked with a small
+  // offset and pushed apart by the contact resolution.
+  const int32_t pitch_x = level->proj_width + BALL_SPAWN_GAP;
+  const int32_t pitch_y = level->proj_height + BALL_SPAWN_GAP;
+  const int32_t top = level->target_y_padding +
+                      TARGET_Y_PITCH * (level->rows - 1) + TARGET_HEIGHT +
+                      pitch_y;
+  const int32_t bottom = (int32_t)barStartY(level) - 2 * pitch_y;
+  const int32_t cols = (level->width - BALL_SPAWN_GAP) / pitch_x;
+  const int32_t rows = bottom > top ? (bottom - top) / pitch_y : 1;
+  for (int32_t i = 1; i < count; i++) {
+    const int32_t slot = (i - 1) % (cols * rows);
+    const int32_t layer = (i - 1) / (cols * rows);
+    balls->proj[i] = (Projectile){
+        .pos =
+            (Vector2D){
+                .x = BALL_SPAWN_GAP + (slot % cols) * pitch_x + layer,
+                .y = top + (slot / cols) * pitch_y + layer,
+            },
+        .vel =
+            (Vector2D){
+                .x = i % 2 ? -level->proj_speed : level->proj_speed,
+                .y = -level->proj_speed,
+            },
+    };
+    balls->order[i] = i;
+  }
+}
+
+void removeBall(Balls *const balls, const int32_t i) {
+  const int32_t last = --balls->count;
+  balls->proj[i] = balls->proj[last];
+  // Drop i from the sorted order and rename last to i, keeping it sorted
+  int32_t *const order = balls->order;
+  int32_t k = 0;
+  for (int32_t j = 0; j <= last; j++) {
+    if (order[j] == i)
+      continue;
+    order[k++] = order[j] == last ? i : order[j];
+  }
+}
+
+void sortBallsByX(Balls *const balls) {
+  int32_t *const order = balls->order;
+  for (int32_t i = 1; i < balls->count; i++) {
+    const int32_t ball = order[i];
+    const float x = balls->proj[ball].pos.x;
+    int32_t k = i;
+    while (k > 0 && balls->proj[order[k - 1]].pos.x > x) {
+      order[k] = order[k - 1];
+      k--;
+    }
+    order[k] = ball;
+  }
+}
+
+// Separates two overlapping balls along the axis of least penetration and
+// exchanges their velocities along it if they move towards each other (elastic
+// collision of equal masses).
+void resolveBallContact(const Level *const level, Projectile *const a,
+                        Projectile *const b) {
+  const float dx = b->pos.x - a->pos.x;
+  const float dy = b->pos.y - a->pos.y;
+  const float penetration_x = level->proj_width - fabsf(dx);
+  const float penetration_y = level->proj_height - fabsf(dy);
+  if (penetration_x <= 0 || penetration_y <= 0)
+    return;
+
+  if (penetration_x < penetration_y) {
+    const float shift = SIGN(dx) * penetration_x / 2;
+    a->pos.x = FCLAMP(a->pos.x - shift, 0, level->width - level->proj_width);
+    b->pos.x = FCLAMP(b->pos.x + shift, 0, level->width - level->proj_width);
+    if ((b->vel.x - a->vel.x) * SIGN(dx) < 0) {
+      const float vel = a->vel.x;
+      a->vel.x = b->vel.x;
+      b->vel.x = vel;
+    }
+  } else {
+    const float shift = SIGN(dy) * penetration_y / 2;
+    a->pos.y = FCLAMP(a->pos.y - shift, 0, level->height - level->proj_height);
+    b->pos.y = FCLAMP(b->pos.y + shift, 0, level->height - level->proj_height);
+    if ((b->vel.y - a->vel.y) * SIGN(dy) < 0) {
+      const float vel = a->vel.y;
+      a->vel.y = b->vel.y;
+      b->vel.y = vel;
+    }
+  }
+}
+
+void resolveBallContacts(Balls *const balls, const Level *const level) {
+  sortBallsByX(balls);
+  float *const xs = balls->sorted_x;
+  float *const ys = balls->sorted_y;
+  for (int32_t i = 0; i < balls->count; i++) {
+    const Projectile *const proj = &balls->proj[balls->order[i]];
+    xs[i] = proj->pos.x;
+    ys[i] = proj->pos.y;
+  }
+  for (int32_t i = 0; i < balls->count; i++) {
+    for (int32_t k = i + 1;
+         k < balls->count && xs[k] < xs[i] + level->proj_width; k++) {
+      if (fabsf(ys[k] - ys[i]) >= level->proj_height)
+        continue;
+      Projectile *const a = &balls->proj[balls->order[i]];
+      Projectile *const b = &balls->proj[balls->order[k]];
+      resolveBallContact(level, a, b);
+      // Keep the sweep consistent with the separated positions
+      xs[i] = a->pos.x;
+      ys[i] = a->pos.y;
+      xs[k] = b->pos.x;
+      ys[k] = b->pos.y;
+    }
+  }
+}
+
+// Moves all balls and resolves their collisions with the walls, the bar and
+// the targets. Returns true if the last ball is lost.
+bool updateBalls(Balls *const balls, Targets *const targets,
+                 Particles *const particles, const Bar *const bar,
+                 uint64_t *const score) {
+  bool lost = false;
+  for (int32_t i = 0; i < balls->count; i++) {
+    const bool ball_lost =
+        hasLost(&balls->proj[i], targets->level); // before the update
+    updateProj(&balls->proj[i], targets, particles, bar, score);
+    if (ball_lost) {
+      if (balls->count == 1) {
+        lost = true;
+      } else {
+        removeBall(balls, i);
+        i--;
+      }
+    }
+  }
+  return lost;
+}
+
+void drawBalls(const Balls *const balls, const Level *const level,
+               GeometryBatch *const batch) {
+  for (int32_t i = 0; i < balls->count; i++)
+    drawProj(&balls->proj[i], level, batch);
+}
+
+/******* LEADERBOARD ********/
+
+// The best scores are kept in a journal of checksummed records that are only
+// ever appended. This is what makes a plain append crash safe: a record torn by
+// a crash fails its checksum and ends the journal when it is loaded, and the
+// next write compacts the journal into a temporary file that atomically
+// replaces it. Writes go through a background thread, so a frame
+// never waits for the disk, and a lock file keeps several instances from
+// overwriting each other's scores.
+
+#define LEADERBOARD_SIZE 10
+#define LEADERBOARD_MAX_RECORDS (4 * LEADERBOARD_SIZE) // compacted beyond
+#define LEADERBOARD_QUEUE 16
+#define LEADERBOARD_PATH_SIZE 256
+#define SCORE_RECORD_MAGIC 0x53554F43 // "COUS" in little endian
+#define SCORE_RECORD_SIZE 24
+
+typedef struct ScoreEntry_s {
+  uint64_t score;
+  int64_t time; // seconds since the epoch
+} ScoreEntry;
+
+typedef struct Leaderboard_s {
+  ScoreEntry entries[LEADERBOARD_SIZE]; // best score first
+  int32_t count;
+} Leaderboard;
+
+typedef struct ScoreWriter_s {
+  SDL_Thread *thread;
+  SDL_mutex *lock;
+  SDL_cond *wake;
+  bool stop;
+  ScoreEntry queue[LEADERBOARD_QUEUE];
+  int32_t queued;
+  const char *path;
+} ScoreWriter;
+
+uint32_t crc32(const uint8_t *const data, const size_t size) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+void storeLittleEndian(uint8_t *const out, uint64_t value, const int bytes) {
+  for (int i = 0; i < bytes; i++, value >>= 8)
+    out[i] = value & 0xFF;
+}
+
+uint64_t loadLittleEndian(const uint8_t *const in, const int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    value = value << 8 | in[i];
+  return value;
+}
+
+// A record is the magic, the CRC-32 of the rest, the score and the time
+void encodeScoreRecord(const ScoreEntry *const entry, uint8_t *const record) {
+  storeLittleEndian(record, SCORE_RECORD_MAGIC, 4);
+  storeLittleEndian(record + 8, entry->score, 8);
+  storeLittleEndian(record + 16, (uint64_t)entry->time, 8);
+  storeLittleEndian(record + 4, crc32(record + 8, SCORE_RECORD_SIZE - 8), 4);
+}
+
+bool decodeScoreRecord(const uint8_t *const record, ScoreEntry *const entry) {
+  if (loadLittleEndian(record, 4) != SCORE_RECORD_MAGIC ||
+      loadLittleEndian(record + 4, 4) !=
+          crc32(record + 8, SCORE_RECORD_SIZE - 8))
+    return false;
+  entry->score = loadLittleEndian(record + 8, 8);
+  entry->time = (int64_t)loadLittleEndian(record + 16, 8);
+  return true;
+}
+
+void insertScore(Leaderboard *const board, const ScoreEntry entry) {
+  int32_t i = board->count;
+  if (board->count < LEADERBOARD_SIZE)
+    board->count++;
+  for (; i > 0 && board->entries[i - 1].score < entry.score; i--)
+    if (i < LEADERBOARD_SIZE)
+      board->entries[i] = board->entries[i - 1];
+  if (i < LEADERBOARD_SIZE)
+    board->entries[i] = entry;
+}
+
+// Returns false if the journal ends in a damaged record. A missing journal is
+// an empty leaderboard.
+bool loadLeaderboard(Leaderboard *const board, const char *const path,
+                     int32_t *const records) {
+  *board = (Leaderboard){0};
+  *records = 0;
+  FILE *const file = fopen(path, "rb");
+  if (!file)
+    return true;
+  uint8_t record[SCORE_RECORD_SIZE];
+  ScoreEntry entry;
+  size_t size;
+  while ((size = fread(record, 1, SCORE_RECORD_SIZE, file)) ==
+             SCORE_RECORD_SIZE &&
+         decodeScoreRecord(record, &entry)) {
+    insertScore(board, entry);
+    (*records)++;
+  }
+  fclose(file);
+  return size == 0;
+}
+
+// The lock is taken on a separate file because compacting replaces the
+// journal. Closing the file releases it.
+int lockLeaderboard(const char *const path) {
+  char lock_path[LEADERBOARD_PATH_SIZE];
+  snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+#if POSIX_FILES
+  const int fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+  if (fd >= 0 && !flock(fd, LOCK_EX))
+    return fd;
+  if (fd >= 0)
+    close(fd);
+#elif defined(_WIN32)
+  const int fd = _open(lock_path, _O_RDWR | _O_CREAT, _S_IREAD | _S_IWRITE);
+  OVERLAPPED region = {0};
+  if (fd >= 0 && LockFileEx((HANDLE)_get_osfhandle(fd),
+                            LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &region))
+    return fd;
+  if (fd >= 0)
+    _close(fd);
+#endif
+  SDL_Log("Unable to lock %s, writing the leaderboard without it", lock_path);
+  return -1;
+}
+
+void unlockLeaderboard(const int lock) {
+  if (lock < 0)
+    return;
+#if POSIX_FILES
+  close(lock);
+#elif defined(_WIN32)
+  OVERLAPPED region = {0};
+  UnlockFileEx((HANDLE)_get_osfhandle(lock), 0, 1, 0, &region);
+  _close(lock);
+#endif
+}
+
+bool closeSynced(FILE *const file) {
+  bool failed = fflush(file) != 0;
+#if POSIX_FILES
+  failed = failed | (fsync(fileno(file)) != 0);
+#elif defined(_WIN32)
+  failed = failed | (_commit(_fileno(file)) != 0);
+#endif
+  failed = failed | (ferror(file) != 0) | (fclose(file) != 0);
+  return !failed;
+}
+
+// Atomically replaces the file to with the file from
+bool replaceFile(const char *const from, const char *const to) {
+#ifdef _WIN32
+  return MoveFileExA(from, to,
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return !rename(from, to);
+#endif
+}
+
+bool writeScoreRecords(FILE *const file, const ScoreEntry *const entries,
+                       const int32_t count) {
+  uint8_t record[SCORE_RECORD_SIZE];
+  for (int32_t i = 0; i < count; i++) {
+    encodeScoreRecord(&entries[i], record);
+    if (fwrite(record, 1, SCORE_RECORD_SIZE, file) != SCORE_RECORD_SIZE)
+      return false;
+  }
+  return true;
+}
+
+// Appends the entries to the journal, or rewrites it with the best scores if
+// it is damaged or too long. An append that is cut short by a crash leaves a
+// torn record, which the next call finds and compacts away.
+bool storeScores(const char *const path, const ScoreEntry *const entries,
+                 const int32_t count) {
+  TRACE_ZONE("storeScores");
+  const int lock = lockLeaderboard(path);
+  Leaderboard board;
+  int32_t records;
+  const bool intact = loadLeaderboard(&board, path, &records);
+  bool stored = false;
+  if (intact && records + count <= LEADERBOARD_MAX_RECORDS) {
+    FILE *const file = fopen(path, "ab");
+    if (file)
+      stored = writeScoreRecords(file, entries, count) & closeSynced(file);
+  } else {
+    for (int32_t i = 0; i < count; i++)
+      insertScore(&board, entries[i]);
+    char temp_path[LEADERBOARD_PATH_SIZE];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *const file = fopen(temp_path, "wb");
+    if (file) {
+      stored = writeScoreRecords(file, board.entries, board.count) &
+               closeSynced(file);
+      stored = stored && replaceFile(temp_path, path);
+      if (!stored)
+        remove(temp_path);
+    }
+  }
+  unlockLeaderboard(lock);
+  if (!stored)
+    SDL_Log("Unable to write the leaderboard %s", path);
+  return stored;
+}
+
+int writeScores(void *const data) {
+  ScoreWriter *const writer = data;
+  ScoreEntry entries[LEADERBOARD_QUEUE];
+  SDL_LockMutex(writer->lock);
+  for (;;) {
+    while (!writer->stop && writer->queued == 0)
+      SDL_CondWait(writer->wake, writer->lock);
+    const int32_t count = writer->queued;
+    if (count == 0)
+      break; // stopped and every score is written
+    memcpy(entries, writer->queue, count * sizeof(ScoreEntry));
+    writer->queued = 0;
+    SDL_UnlockMutex(writer->lock);
+    storeScores(writer->path, entries, count);
+    SDL_LockMutex(writer->lock);
+  }
+  SDL_UnlockMutex(writer->lock);
+  return 0;
+}
+
+// Without a thread the scores are written by submitScore itself
+void startScoreWriter(ScoreWriter *const writer, const char *const path) {
+  *writer = (ScoreWriter){.path = path};
+  writer->lock = SDL_CreateMutex();
+  writer->wake = SDL_CreateCond();
+  if (writer->lock && writer->wake)
+    writer->thread = SDL_CreateThread(writeScores, "leaderboard", writer);
+  if (!writer->thread)
+    SDL_Log("Unable to start the leaderboard writer, writing on the render "
+            "thread: %s",
+            SDL_GetError());
+}
+
+void submitScore(ScoreWriter *const writer, const uint64_t score) {
+  const ScoreEntry entry = {.score = score, .time = (int64_t)time(NULL)};
+  if (!writer->thread) {
+    storeScores(writer->path, &entry, 1);
+    return;
+  }
+  SDL_LockMutex(writer->lock);
+  if (writer->queued < LEADERBOARD_QUEUE) {
+    writer->queue[writer->queued++] = entry;
+  } else {
+    // The queue is longer than the leaderboard, so the lowest queued score
+    // would not make it anyway
+    int32_t lowest = 0;
+    for (int32_t i = 1; i < LEADERBOARD_QUEUE; i++)
+      if (writer->queue[i].score < writer->queue[lowest].score)
+        lowest = i;
+    if (writer->queue[lowest].score < entry.score)
+      writer->queue[lowest] = entry;
+  }
+  SDL_CondSignal(writer->wake);
+  SDL_UnlockMutex(writer->lock);
+}
+
+// Waits until every submitted score is written
+void stopScoreWriter(ScoreWriter *const writer) {
+  if (writer->thread) {
+    SDL_LockMutex(writer->lock);
+    writer->stop = true;
+    SDL_CondSignal(writer->wake);
+    SDL_UnlockMutex(writer->lock);
+    SDL_WaitThread(writer->thread, NULL);
+    writer->thread = NULL;
+  }
+  if (writer->wake)
+    SDL_DestroyCond(writer->wake);
+  if (writer->lock)
+    SDL_DestroyMutex(writer->lock);
+  writer->wake = NULL;
+  writer->lock = NULL;
+}
+
+// Loads the leaderboard and starts its writer. The highscore of older versions
+// moves into an empty leaderboard.
+void openLeaderboard(Leaderboard *const board, ScoreWriter *const writer,
+                     const char *const path) {
+  int32_t records;
+  loadLeaderboard(board, path, &records);
+  startScoreWriter(writer, path);
+  FILE *const legacy = board->count ? NULL : fopen(HIGHSCORE_FILE_NAME, "r");
+  if (!legacy)
+    return;
+  uint64_t highscore;
+  if (fscanf(legacy, "%" SCNu64, &highscore) == 1 && highscore > 0) {
+    insertScore(board, (ScoreEntry){.score = highscore});
+    submitScore(writer, highscore);
+  }
+  fclose(legacy);
+}
+
+void logLeaderboard(const char *const path) {
+  Leaderboard board;
+  int32_t records;
+  loadLeaderboard(&board, path, &records);
+  for (int32_t i = 0; i < board.count; i++) {
+    char date[32] = "";
+    const time_t when = board.entries[i].time;
+    const struct tm *const local = when ? localtime(&when) : NULL;
+    if (local)
+      strftime(date, sizeof(date), "%Y-%m-%d %H:%M", local);
+    SDL_Log("%2" PRId32 ". %8" PRIu64 "  %s", i + 1, board.entries[i].score,
+            date);
+  }
+}
+
+/******* GAME STATE ********/
+
+typedef struct GameInput_s {
+  bool a_pressed;
+  bool d_pressed;
+  int mouse_x; // <= 0 if the mouse is not dragging the bar
+  bool toggle_pause;
+  bool reset;
+} GameInput;
+
+typedef enum {
+  SIM_PHASE_BAR,
+  SIM_PHASE_PARTICLES,
+  SIM_PHASE_PROJ,
+  SIM_PHASE_BALL_CONTACTS,
+  SIM_PHASE_WON,
+  SIM_PHASE_COUNT,
+} SimPhase;
+
+static const char *const SIM_PHASE_NAMES[SIM_PHASE_COUNT] = {
+    [SIM_PHASE_BAR] = "updateBar",
+    [SIM_PHASE_PARTICLES] = "updateParticles",
+    [SIM_PHASE_PROJ] = "updateProj",
+    [SIM_PHASE_BALL_CONTACTS] = "ballContacts",
+    [SIM_PHASE_WON] = "hasWon",
+};
+
+typedef struct SimTimings_s {
+  uint64_t ticks[SIM_PHASE_COUNT]; // accumulated SDL performance counter ticks
+} SimTimings;
+
+#define TIME_PHASE(timings, phase, stmt)                                       \
+  do {                                                                         \
+    const uint64_t phase_start_ = (timings) ? SDL_GetPerformanceCounter() : 0; \
+    stmt;                                                                      \
+    if (timings)                                                               \
+      (timings)->ticks[phase] += SDL_GetPerformanceCounter() - phase_start_;   \
+  } while (0)
+
+typedef struct Game_s {
+  bool pause;
+  bool started;
+  bool won;
+  bool lost;
+  uint64_t score;
+  uint64_t highscore;
+  int32_t ball_number; // number of balls at the start
+  bool random_serve;   // see placeServe
+  Level level;
+  Arena arena; // holds the arrays of balls, targets and particles
+  Bar bar;
+  Balls balls;
+  Targets targets;
+  Particles particles;
+} Game;
+
+size_t levelArenaSize(const Level *const level) {
+  return ARENA_SIZE(sizeof(uint64_t) * level->target_words) +
+         ARENA_SIZE(sizeof(color_t) * level->rows) +
+         PARTICLE_ARRAYS *
+             ARENA_SIZE(sizeof(float) * level->particle_capacity) +
+         BALL_ARRAYS * ARENA_SIZE(sizeof(Projectile) * level->ball_capacity);
+}
+
+bool allocateLevelState(Game *const game) {
+  Arena *const arena = &game->arena;
+  game->targets.level = &game->level;
+  game->targets.alive =
+      arenaAlloc(arena, sizeof(uint64_t) * game->level.target_words);
+  game->targets.row_colors =
+      arenaAlloc(arena, sizeof(color_t) * game->level.rows);
+  return game->targets.alive && game->targets.row_colors &&
+         allocateParticles(&game->particles, arena,
+                           game->level.particle_capacity) &&
+         allocateBalls(&game->balls, arena, game->level.ball_capacity);
+}
+
+// Headless games start the bar and the first ball at a random point of the
+// middle half of the level, such that the seed decides how a round plays out.
+// Games in the window always start in the middle.
+void placeServe(Game *const game) {
+  const float offset = floorf((randomFloat(&game->particles.random) - 0.5f) *
+                              game->level.width / 2);
+  game->bar.pos.x += offset;
+  game->balls.proj[0].pos.x += offset;
+}
+
+// Restarts the level. The state of the previous round is dropped by rewinding
+// the arena. Returns false if the arena is too small, which cannot happen
+// after initializeGame succeeded.
+bool resetGame(Game *const game) {
+  arenaReset(&game->arena);
+  if (!allocateLevelState(game))
+    return false;
+  game->bar = initialBar(&game->level);
+  initializeBalls(&game->balls, &game->level, game->ball_number);
+  if (game->random_serve)
+    placeServe(game);
+  initializeTargets(&game->targets);
+  initializeParticles(&game->particles);
+  game->started = false;
+  game->pause = false;
+  game->won = false;
+  game->lost = false;
+  game->score = 0;
+  return true;
+}
+
+// Allocates the arena for the level once and starts the first round. The
+// random state is seeded once, later rounds continue its sequence.
+bool initializeGame(Game *const game, const Level *const level,
+                    const uint64_t seed) {
+  *game = (Game){.level = *level, .ball_number = level->ball_capacity};
+  game->particles.random = seededRandom(seed);
+  if (!initializeArena(&game->arena, levelArenaSize(level)) ||
+      !resetGame(game)) {
+    freeArena(&game->arena);
+    return false;
+  }
+  return true;
+}
+
+void freeGame(Game *const game) { freeArena(&game->arena); }
+
+// Advances the simulation by one frame (DELTA_TIME_SEC). Does not touch SDL
+// video, so it can run without a window. timings may be NULL.
+void stepGame(Game *const game, const GameInput *const input,
+              SimTimings *const timings) {
+  const bool a_pressed = input->a_pressed;
+  const bool d_pressed = input->d_pressed;
+  const int mouseX = input->mouse_x;
+
+  if (input->toggle_pause)
+    game->pause = !game->pause;
+  if (input->reset)
+    resetGame(game);
+
+  if (!game->started && (a_pressed || d_pressed || mouseX > 0)) {
+    game->started = true;
+    Projectile *const proj = &game->balls.proj[0];
+    const int32_t speed = game->level.proj_speed;
+    if (mouseX > 0)
+      proj->vel.x = mouseX < (game->level.width / 2) ? -speed : speed;
+    else
+      proj->vel.x = a_pressed ? -speed : speed;
+  }
+
+  if (game->pause || !game->started)
+    return;
+
+  if (game->won || game->lost)
+    return;
+
+  Bar *const bar = &game->bar;
+  if (mouseX > 0) {
+    bar->pos.x = mouseX;
+    bar->vel = 0;
+  } else if (a_pressed && !d_pressed) {
+    setBarSpeedLeft(bar, &game->level);
+  } else if (d_pressed && !a_pressed) {
+    setBarSpeedRight(bar, &game->level);
+  } else {
+    bar->vel = 0;
+  }
+  TIME_PHASE(timings, SIM_PHASE_BAR, updateBar(bar, &game->level));
+  TIME_PHASE(timings, SIM_PHASE_PARTICLES, updateParticles(&game->particles));
+
+  TIME_PHASE(timings, SIM_PHASE_PROJ,
+             game->lost = updateBalls(&game->balls, &game->targets,
+                                      &game->particles, bar, &game->score));
+  if (game->balls.count > 1)
+    TIME_PHASE(timings, SIM_PHASE_BALL_CONTACTS,
+               resolveBallContacts(&game->balls, &game->level));
+
+  TIME_PHASE(timings, SIM_PHASE_WON, game->won = hasWon(&game->targets));
+  // Right away, the next step may already reset the level
+  if ((game->won || game->lost) && game->score > game->highscore)
+    game->highscore = game->score;
+}
+
+typedef enum {
+  DRAW_PHASE_TARGETS,
+  DRAW_PHASE_BALLS,
+  DRAW_PHASE_PARTICLES,
+  DRAW_PHASE_TEXT,
+  DRAW_PHASE_COUNT,
+} DrawPhase;
+
+static const char *const DRAW_PHASE_NAMES[DRAW_PHASE_COUNT] = {
+    [DRAW_PHASE_TARGETS] = "drawTargets",
+    [DRAW_PHASE_BALLS] = "drawBalls",
+    [DRAW_PHASE_PARTICLES] = "drawParticles",
+    [DRAW_PHASE_TEXT] = "writeScore",
+};
+
+typedef struct DrawTimings_s {
+  uint64_t ticks[DRAW_PHASE_COUNT];
+} DrawTimings;
+
+typedef struct GameRenderer_s {
+  SDL_Renderer *renderer;
+  RenderBatches batches;
+  TextCache text_cache;
+  TargetLayer target_layer;
+  TTF_Font *game_font;  // NULL until the font loader is done
+  TTF_Font *score_font; // NULL until the font loader is done
+} GameRenderer;
+
+typedef enum {
+  MESSAGE_START,
+  MESSAGE_CONTROLS,
+  MESSAGE_PAUSED,
+  MESSAGE_WON,
+  MESSAGE_LOST,
+  MESSAGE_COUNT,
+} Message;
+
+static const char *const MESSAGES[MESSAGE_COUNT] = {
+    [MESSAGE_START] = "Press A or D to move the bar and start the game. If it "
+                      "is too difficult use the mouse.",
+#if !FOR_WASM
+    [MESSAGE_CONTROLS] =
+        "While playing press SPACE to pause, Q to quit or R to restart.",
+    [MESSAGE_PAUSED] = "Press SPACE to continue, Q to quit or R to restart.",
+    [MESSAGE_WON] = "You won! Press R to restart or Q to quit.",
+    [MESSAGE_LOST] = "You lost! Press R to restart or Q to quit.",
+#else
+    [MESSAGE_CONTROLS] = "While playing press SPACE to pause or R to restart.",
+    [MESSAGE_PAUSED] = "Press SPACE to continue or R to restart.",
+    [MESSAGE_WON] = "You won! Press R to restart.",
+    [MESSAGE_LOST] = "You lost! Press R to restart.",
+#endif
+};
+
+// timings may be NULL
+void drawGame(const Game *const game, GameRenderer *const view,
+              DrawTimings *const timings) {
+  SDL_Renderer *const renderer = view->renderer;
+  RenderBatches *const batches = &view->batches;
+  TextCache *const text_cache = &view->text_cache;
+  TTF_Font *const game_font = view->game_font;
+
+  drawBackground(renderer);
+  // Levels larger than the window are scaled down, the text is not
+  const float scale = 1 / game->level.scale;
+  TIME_PHASE(timings, DRAW_PHASE_TARGETS, {
+    if (view->target_layer.texture) {
+      updateTargetLayer(&view->target_layer, &game->targets, renderer,
+                        &batches->opaque);
+      SDL_RenderCopy(renderer, view->target_layer.texture, NULL, NULL);
+      SDL_RenderSetScale(renderer, scale, scale);
+    } else {
+      SDL_RenderSetScale(renderer, scale, scale);
+      drawTargets(&game->targets, &batches->opaque);
+    }
+  });
+  TIME_PHASE(timings, DRAW_PHASE_BALLS, {
+    drawBalls(&game->balls, &game->level, &batches->opaque);
+    drawBar(&game->bar, &game->level, &batches->opaque);
+    submitBatch(&batches->opaque);
+  });
+  TIME_PHASE(timings, DRAW_PHASE_PARTICLES, {
+    drawParticles(&game->particles, &batches->blended);
+    submitBatch(&batches->blended);
+  });
+  SDL_RenderSetScale(renderer, 1, 1);
+
+  const uint64_t text_start = timings ? SDL_GetPerformanceCounter() : 0;
+  if (game_font && view->score_font) {
+    writeScore(game->score, game->highscore, text_cache, view->score_font);
+    if (!game->started) {
+      renderXYCenteredText(text_cache, MESSAGES[MESSAGE_START], TEXT_COLOR,
+                           game_font);
+      renderXCenteredText(text_cache, MESSAGES[MESSAGE_CONTROLS], TEXT_COLOR,
+                          game_font, WINDOW_HEIGHT / 2 + 20 * SCALING);
+    } else if (game->pause) {
+      renderXYCenteredText(text_cache, MESSAGES[MESSAGE_PAUSED], TEXT_COLOR,
+                           game_font);
+    } else if (game->won) {
+      renderXYCenteredText(text_cache, MESSAGES[MESSAGE_WON], TEXT_COLOR,
+                           game_font);
+    } else if (game->lost) {
+      renderXYCenteredText(text_cache, MESSAGES[MESSAGE_LOST], TEXT_COLOR,
+                           game_font);
+    }
+  }
+  if (timings)
+    timings->ticks[DRAW_PHASE_TEXT] += SDL_GetPerformanceCounter() - text_start;
+}
+
+/******* FONT LOADING ********/
+
+// The font file is read once and both sizes are opened from memory. A worker
+// loads it and rasterizes the texts of the game while the first frames are
+// shown without text, so the render thread only has to upload the textures.
+
+#define GAME_FONT_SIZE 28
+#define SCORE_FONT_SIZE 20
+#define FONT_PATH_SIZE 1024
+#define PRERENDERED_TEXTS (MESSAGE_COUNT + 2)
+
+#if EMBED_FONT
+// Defines embedded_font, generated by the build from the font file
+#include "embedded_font.h"
+#endif
+
+typedef struct PrerenderedText_s {
+  const char *text;
+  TTF_Font *font;
+  SDL_Surface *surface; // NULL if the text could not be rasterized
+} PrerenderedText;
+
+typedef struct FontLoader_s {
+  SDL_Thread *thread;
+  SDL_atomic_t done;
+  void *data; // the font file, which has to outlive the fonts
+  TTF_Font *game_font;  // NULL once handed to the renderer
+  TTF_Font *score_font; // NULL once handed to the renderer
+  PrerenderedText texts[PRERENDERED_TEXTS];
+  SDL_Surface *digits[10]; // digits[0] is NULL if they are not rasterized
+} FontLoader;
+
+// Looks for the font next to the executable first, so the game can be started
+// from any directory, and then in the working directory.
+void *readFontFile(size_t *const size) {
+  static const char *const names[] = {"../" FONT_FILE_NAME, FONT_FILE_NAME};
+  char *const base = SDL_GetBasePath();
+  void *data = NULL;
+  for (int i = 0; !data && i < 4; i++) {
+    char path[FONT_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s%s", i < 2 && base ? base : "",
+             names[i % 2]);
+    data = SDL_LoadFile(path, size);
+  }
+  SDL_free(base);
+  if (!data)
+    SDL_Log("Unable to find the font %s", FONT_FILE_NAME);
+  return data;
+}
+
+void rasterizeTexts(FontLoader *const loader) {
+  TRACE_ZONE("rasterizeTexts");
+  for (int32_t i = 0; i < MESSAGE_COUNT; i++)
+    loader->texts[i] =
+        (PrerenderedText){.text = MESSAGES[i], .font = loader->game_font};
+  loader->texts[MESSAGE_COUNT] =
+      (PrerenderedText){.text = SCORE_LABEL, .font = loader->score_font};
+  loader->texts[MESSAGE_COUNT + 1] =
+      (PrerenderedText){.text = HIGHSCORE_LABEL, .font = loader->score_font};
+  for (int32_t i = 0; i < PRERENDERED_TEXTS; i++) {
+    PrerenderedText *const text = &loader->texts[i];
+    text->surface = rasterizeText(text->text, TEXT_COLOR, text->font);
+  }
+  if (!rasterizeDigitGlyphs(loader->digits, TEXT_COLOR, loader->score_font))
+    loader->digits[0] = NULL;
+}
+
+int loadFonts(void *const data) {
+  TRACE_ZONE("loadFonts");
+  FontLoader *const loader = data;
+#if EMBED_FONT
+  const void *const font = embedded_font;
+  const size_t size = sizeof(embedded_font);
+#else
+  size_t size = 0;
+  loader->data = readFontFile(&size);
+  const void *const font = loader->data;
+#endif
+  if (font) {
+    loader->game_font = TTF_OpenFontRW(SDL_RWFromConstMem(font, size), 1,
+                                       GAME_FONT_SIZE);
+    loader->score_font = TTF_OpenFontRW(SDL_RWFromConstMem(font, size), 1,
+                                        SCORE_FONT_SIZE);
+    if (!loader->game_font || !loader->score_font)
+      SDL_Log("Unable to load font: %s", TTF_GetError());
+    else
+      rasterizeTexts(loader);
+  }
+  SDL_AtomicSet(&loader->done, 1);
+  return 0;
+}
+
+// The fonts must not be used until the loader is done. Without threads they
+// are loaded right away.
+void startFontLoader(FontLoader *const loader) {
+  *loader = (FontLoader){0};
+#if !FOR_WASM
+  loader->thread = SDL_CreateThread(loadFonts, "fonts", loader);
+  if (loader->thread)
+    return;
+  SDL_Log("Unable to start the font loader, loading on the render thread: %s",
+          SDL_GetError());
+#endif
+  loadFonts(loader);
+}
+
+bool fontsLoaded(FontLoader *const loader) {
+  return SDL_AtomicGet(&loader->done) != 0;
+}
+
+// Hands the fonts and the rasterized texts to the renderer once the loader is
+// done. Returns false if the fonts could not be loaded.
+bool takeFonts(FontLoader *const loader, GameRenderer *const view) {
+  TRACE_ZONE("takeFonts");
+  if (loader->thread)
+    SDL_WaitThread(loader->thread, NULL);
+  loader->thread = NULL;
+  if (!loader->game_font || !loader->score_font)
+    return false;
+  for (int32_t i = 0; i < PRERENDERED_TEXTS; i++) {
+    PrerenderedText *const text = &loader->texts[i];
+    if (text->surface)
+      cacheTextSurface(&view->text_cache, text->text, TEXT_COLOR, text->font,
+                       text->surface);
+    text->surface = NULL;
+  }
+  if (loader->digits[0])
+    setDigitGlyphs(&view->text_cache, TEXT_COLOR, loader->score_font,
+                   loader->digits);
+  loader->digits[0] = NULL;
+  view->game_font = loader->game_font;
+  view->score_font = loader->score_font;
+  loader->game_font = NULL;
+  loader->score_font = NULL;
+  return true;
+}
+
+// Frees what was not handed to the renderer. The fonts of the renderer have to
+// be closed before.
+void stopFontLoader(FontLoader *const loader) {
+  if (loader->thread)
+    SDL_WaitThread(loader->thread, NULL);
+  loader->thread = NULL;
+  for (int32_t i = 0; i < PRERENDERED_TEXTS; i++) {
+    if (loader->texts[i].surface)
+      SDL_FreeSurface(loader->texts[i].surface);
+    loader->texts[i].surface = NULL;
+  }
+  if (loader->digits[0])
+    for (int i = 0; i < 10; i++)
+      SDL_FreeSurface(loader->digits[i]);
+  loader->digits[0] = NULL;
+  if (loader->game_font)
+    TTF_CloseFont(loader->game_font);
+  if (loader->score_font)
+    TTF_CloseFont(loader->score_font);
+  loader->game_font = NULL;
+  loader->score_font = NULL;
+  SDL_free(loader->data);
+  loader->data = NULL;
+}
+
+/******* FRAME PACING ********/
+
+// The last part of the frame budget is spent spinning instead of sleeping,
+// because SDL_Delay only sleeps whole milliseconds and may oversleep a little.
+// Both the render and the simulation thread are paced, so the spin is kept
+// short. In the browser spinning blocks the event loop, so we only sleep there.
+#if !FOR_WASM
+#define PACER_SPIN_MS 0.5
+#else
+#define PACER_SPIN_MS 0.0
+#endif
+
+typedef enum {
+  PACING_CAPPED,   // sleep + spin until the next frame deadline
+  PACING_UNCAPPED, // run as fast as possible
+  PACING_VSYNC,    // let SDL_RenderPresent block on the display refresh
+} PacingMode;
+
+typedef struct FramePacer_s {
+  PacingMode mode;
+  uint64_t frequency;     // performance counter ticks per second
+  uint64_t target_ticks;  // frame budget
+  uint64_t spin_ticks;    // part of the budget that is spin-waited
+  uint64_t deadline;      // end of the current frame
+  uint64_t frame_start;   // start of the current frame
+  // Statistics of the frame times (start to start) and of the frame work:
+  uint64_t frames;
+  uint64_t missed; // frames whose work took longer than the budget
+  double sum_ms;
+  double sum_sq_ms;
+  double min_ms;
+  double max_ms;
+  double sum_work_ms;
+} FramePacer;
+
+FramePacer initialFramePacer(const PacingMode mode) {
+  const uint64_t frequency = SDL_GetPerformanceFrequency();
+  const uint64_t now = SDL_GetPerformanceCounter();
+  const uint64_t target_ticks = frequency / FPS;
+  return (FramePacer){
+      .mode = mode,
+      .frequency = frequency,
+      .target_ticks = target_ticks,
+      .spin_ticks = PACER_SPIN_MS * frequency / 1000,
+      .deadline = now + target_ticks,
+      .frame_start = now,
+      .min_ms = INFINITY,
+  };
+}
+
+double pacerTicksToMs(const FramePacer *const pacer, const uint64_t ticks) {
+  return ticks * 1000.0 / pacer->frequency;
+}
+
+// Waits for the remaining frame budget (depending on the mode) and records the
+// frame time statistics. Call it once per frame after SDL_RenderPresent.
+void pacerEndFrame(FramePacer *const pacer) {
+  uint64_t now = SDL_GetPerformanceCounter();
+  const uint64_t work = now - pacer->frame_start;
+
+  if (pacer->mode == PACING_CAPPED) {
+    if (now < pacer->deadline) {
+      const uint64_t remaining = pacer->deadline - now;
+      if (remaining > pacer->spin_ticks) {
+        const uint64_t sleep_ms =
+            (remaining - pacer->spin_ticks) * 1000 / pacer->frequency;
+        if (sleep_ms > 0)
+          SDL_Delay(sleep_ms);
+      }
+      while ((now = SDL_GetPerformanceCounter()) < pacer->deadline) {
+      }
+      pacer->deadline += pacer->target_ticks;
+    } else {
+      // More than a frame behind: do not try to catch up with a burst of
+      // short frames, start a fresh schedule instead.
+      pacer->deadline = now + pacer->target_ticks;
+    }
+  }
+
+  const double frame_ms = pacerTicksToMs(pacer, now - pacer->frame_start);
+  const double work_ms = pacerTicksToMs(pacer, work);
+  pacer->frames++;
+  pacer->missed += work > pacer->target_ticks;
+  pacer->sum_ms += frame_ms;
+  pacer->sum_sq_ms += frame_ms * frame_ms;
+  pacer->sum_work_ms += work_ms;
+  pacer->min_ms = fmin(pacer->min_ms, frame_ms);
+  pacer->max_ms = fmax(pacer->max_ms, frame_ms);
+
+  pacer->frame_start = now;
+}
+
+void pacerReport(const FramePacer *const pacer) {
+  if (pacer->frames == 0)
+    return;
+  const double mean = pacer->sum_ms / pacer->frames;
+  const double variance = pacer->sum_sq_ms / pacer->frames - mean * mean;
+  SDL_Log("Frame times over %" PRIu64 " frames: mean %.3f ms, jitter (stddev) "
+          "%.3f ms, min %.3f ms, max %.3f ms",
+          pacer->frames, mean, sqrt(fmax(variance, 0)), pacer->min_ms,
+          pacer->max_ms);
+  SDL_Log("Frame work: mean %.3f ms, %" PRIu64 " frames over the %.3f ms "
+          "budget",
+          pacer->sum_work_ms / pacer->frames, pacer->missed,
+          pacerTicksToMs(pacer, pacer->target_ticks));
+}
+
+/******* QUALITY GOVERNOR ********/
+
+// Holds the frame budget when many targets break at once and their particles
+// make the frames expensive. The work of the frames is smoothed and when it
+// exceeds GOVERNOR_HIGH of the budget the quality drops a level: the particles
+// emitted from then on are fewer and live shorter. A level is only restored
+// after GOVERNOR_CALM_FRAMES frames below GOVERNOR_LOW of the budget, so the
+// quality does not flip back and forth around the budget.
+#define GOVERNOR_SMOOTHING 0.2f // weight of the newest frame
+#define GOVERNOR_HIGH 0.9f
+#define GOVERNOR_LOW 0.6f
+#define GOVERNOR_CALM_FRAMES (2 * FPS)
+// Frames after a drop before the next one, such that the fewer particles show
+#define GOVERNOR_HOLD_FRAMES (FPS / 4)
+
+typedef struct QualityGovernor_s {
+  bool enabled;
+  int32_t level; // 0 is full quality
+  float work_ms; // smoothed work of the frames
+  int32_t calm_frames;
+  int32_t hold_frames;
+  uint64_t drops;
+  int32_t max_level;
+} QualityGovernor;
+
+QualityGovernor initialQualityGovernor(const bool enabled) {
+  return (QualityGovernor){.enabled = enabled};
+}
+
+// Takes the work of a frame and returns the quality level for the next ones.
+int32_t governQuality(QualityGovernor *const governor, const float work_ms) {
+  if (!governor->enabled)
+    return 0;
+  const float budget_ms = 1000.0f / FPS;
+  governor->work_ms += (work_ms - governor->work_ms) * GOVERNOR_SMOOTHING;
+  if (governor->hold_frames > 0)
+    governor->hold_frames--;
+  if (governor->work_ms > GOVERNOR_HIGH * budget_ms) {
+    governor->calm_frames = 0;
+    if (governor->hold_frames == 0 && governor->level < QUALITY_LEVELS - 1) {
+      governor->level++;
+      governor->hold_frames = GOVERNOR_HOLD_FRAMES;
+      governor->drops++;
+      if (governor->level > governor->max_level)
+        governor->max_level = governor->level;
+    }
+  } else if (governor->work_ms < GOVERNOR_LOW * budget_ms) {
+    if (++governor->calm_frames >= GOVERNOR_CALM_FRAMES &&
+        governor->level > 0) {
+      governor->level--;
+      governor->calm_frames = 0;
+    }
+  } else {
+    governor->calm_frames = 0;
+  }
+  return governor->level;
+}
+
+void governorReport(const QualityGovernor *const governor) {
+  if (governor->drops == 0)
+    return;
+  SDL_Log("The quality was lowered %" PRIu64 " times, down to level %" PRId32
+          " of %d",
+          governor->drops, governor->max_level, QUALITY_LEVELS - 1);
+}
+
+/******* PROFILER ********/
+
+// Pressing F3 shows where the time of a frame goes. The phase times of the last
+// PROFILER_SAMPLES frames are kept in a ring buffer, the overlay shows their
+// median (p50) and 99th percentile (p99) as bars and a graph of the frame
+// times, where the line marks the frame budget.
+#define PROFILER_SAMPLES 256
+#define PROFILER_ROWS (1 + SIM_PHASE_COUNT + DRAW_PHASE_COUNT + 1)
+#define PROFILER_ROW_HEIGHT 22
+#define PROFILER_LABEL_WIDTH 150
+#define PROFILER_BAR_WIDTH 150
+#define PROFILER_GRAPH_BAR_WIDTH 2
+#define PROFILER_GRAPH_HEIGHT 80 // two frame budgets
+#define PROFILER_MARGIN 8
+#define PROFILER_WIDTH                                                         \
+  (PROFILER_SAMPLES * PROFILER_GRAPH_BAR_WIDTH + 2 * PROFILER_MARGIN)
+#define PROFILER_HEIGHT                                                        \
+  ((PROFILER_ROWS + 1) * PROFILER_ROW_HEIGHT + PROFILER_GRAPH_HEIGHT +        \
+   3 * PROFILER_MARGIN)
+#define PROFILER_BACKGROUND_COLOR 0x000000C0
+#define PROFILER_P50_COLOR 0x40C0FFFF
+#define PROFILER_P99_COLOR 0x40C0FF60
+#define PROFILER_GOOD_COLOR 0x40FF40FF
+#define PROFILER_BAD_COLOR 0xFF4040FF
+
+// Rows: events, the simulation phases, the draw phases and present
+const char *profilerRowName(const int32_t row) {
+  if (row == 0)
+    return "events";
+  if (row <= SIM_PHASE_COUNT)
+    return SIM_PHASE_NAMES[row - 1];
+  if (row <= SIM_PHASE_COUNT + DRAW_PHASE_COUNT)
+    return DRAW_PHASE_NAMES[row - 1 - SIM_PHASE_COUNT];
+  return "present";
+}
+
+typedef struct Profiler_s {
+  bool visible;
+  uint64_t frequency;
+  int32_t next;  // ring buffer position of the next sample
+  int32_t count; // number of valid samples
+  float samples[PROFILER_ROWS][PROFILER_SAMPLES]; // in us
+  float frame_ms[PROFILER_SAMPLES];
+} Profiler;
+
+void initializeProfiler(Profiler *const profiler) {
+  *profiler = (Profiler){.frequency = SDL_GetPerformanceFrequency()};
+}
+
+void profilerRecord(Profiler *const profiler, const uint64_t events,
+                    const SimTimings *const sim, const DrawTimings *const draw,
+                    const uint64_t present, const uint64_t frame) {
+  const double us_per_tick = 1e6 / profiler->frequency;
+  const int32_t i = profiler->next;
+  int32_t row = 0;
+  profiler->samples[row++][i] = events * us_per_tick;
+  for (int phase = 0; phase < SIM_PHASE_COUNT; phase++)
+    profiler->samples[row++][i] = sim->ticks[phase] * us_per_tick;
+  for (int phase = 0; phase < DRAW_PHASE_COUNT; phase++)
+    profiler->samples[row++][i] = draw->ticks[phase] * us_per_tick;
+  profiler->samples[row++][i] = present * us_per_tick;
+  profiler->frame_ms[i] = frame * us_per_tick / 1000;
+
+  profiler->next = (i + 1) % PROFILER_SAMPLES;
+  if (profiler->count < PROFILER_SAMPLES)
+    profiler->count++;
+}
+
+int compareFloats(const void *const a, const void *const b) {
+  const float x = *(const float *)a;
+  const float y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+void profilerPercentiles(const Profiler *const profiler, const int32_t row,
+                         float *const p50, float *const p99) {
+  float sorted[PROFILER_SAMPLES];
+  const int32_t n = profiler->count;
+  memcpy(sorted, profiler->samples[row], sizeof(float) * n);
+  qsort(sorted, n, sizeof(float), compareFloats);
+  *p50 = sorted[(n - 1) * 50 / 100];
+  *p99 = sorted[(n - 1) * 99 / 100];
+}
+
+void drawProfiler(const Profiler *const profiler, GameRenderer *const view) {
+  if (!profiler->visible || profiler->count == 0)
+    return;
+  GeometryBatch *const batch = &view->batches.blended;
+  TextCache *const text_cache = &view->text_cache;
+  const int32_t x0 = WINDOW_WIDTH - PROFILER_WIDTH - PROFILER_MARGIN;
+  const int32_t y0 = PROFILER_MARGIN;
+
+  float p50[PROFILER_ROWS];
+  float p99[PROFILER_ROWS];
+  float max_us = 1;
+  for (int32_t row = 0; row < PROFILER_ROWS; row++) {
+    profilerPercentiles(profiler, row, &p50[row], &p99[row]);
+    max_us = fmaxf(max_us, p99[row]);
+  }
+
+  const SDL_Rect panel =
+      createSdlRect(x0, y0, PROFILER_WIDTH, PROFILER_HEIGHT);
+  batchRect(batch, &panel, PROFILER_BACKGROUND_COLOR);
+  const int32_t bars_x = x0 + PROFILER_MARGIN + PROFILER_LABEL_WIDTH;
+  for (int32_t row = 0; row < PROFILER_ROWS; row++) {
+    const int32_t y = y0 + PROFILER_MARGIN + (row + 1) * PROFILER_ROW_HEIGHT;
+    const SDL_Rect p99_bar = createSdlRect(
+        bars_x, y + 4, p99[row] / max_us * PROFILER_BAR_WIDTH,
+        PROFILER_ROW_HEIGHT - 8);
+    const SDL_Rect p50_bar = createSdlRect(
+        bars_x, y + 4, p50[row] / max_us * PROFILER_BAR_WIDTH,
+        PROFILER_ROW_HEIGHT - 8);
+    batchRect(batch, &p99_bar, PROFILER_P99_COLOR);
+    batchRect(batch, &p50_bar, PROFILER_P50_COLOR);
+  }
+
+  // Frame times, oldest on the left
+  const float budget_ms = 1000.0f / FPS;
+  const int32_t graph_y = y0 + 2 * PROFILER_MARGIN +
+                          (PROFILER_ROWS + 1) * PROFILER_ROW_HEIGHT +
+                          PROFILER_GRAPH_HEIGHT;
+  for (int32_t k = 0; k < profiler->count; k++) {
+    const int32_t i =
+        (profiler->next - profiler->count + k + PROFILER_SAMPLES) %
+        PROFILER_SAMPLES;
+    const float ms = fminf(profiler->frame_ms[i], 2 * budget_ms);
+    const int32_t h = ms / (2 * budget_ms) * PROFILER_GRAPH_HEIGHT;
+    const SDL_Rect bar =
+        createSdlRect(x0 + PROFILER_MARGIN + k * PROFILER_GRAPH_BAR_WIDTH,
+                      graph_y - h, PROFILER_GRAPH_BAR_WIDTH, h);
+    batchRect(batch, &bar, profiler->frame_ms[i] > budget_ms * 1.05f
+                               ? PROFILER_BAD_COLOR
+                               : PROFILER_GOOD_COLOR);
+  }
+  const SDL_Rect budget_line =
+      createSdlRect(x0 + PROFILER_MARGIN, graph_y - PROFILER_GRAPH_HEIGHT / 2,
+                    PROFILER_SAMPLES * PROFILER_GRAPH_BAR_WIDTH, 1);
+  batchRect(batch, &budget_line, TEXT_COLOR);
+  submitBatch(batch);
+
+  TTF_Font *const font = view->score_font;
+  if (!font)
+    return;
+  renderText(text_cache, "Frame profiler (us), F3 to hide", TEXT_COLOR,
+             &(Vector2D){.x = x0 + PROFILER_MARGIN, .y = y0 + PROFILER_MARGIN},
+             font);
+  for (int32_t row = 0; row < PROFILER_ROWS; row++) {
+    const float y = y0 + PROFILER_MARGIN + (row + 1) * PROFILER_ROW_HEIGHT;
+    renderText(text_cache, profilerRowName(row), TEXT_COLOR,
+               &(Vector2D){.x = x0 + PROFILER_MARGIN, .y = y}, font);
+    const float x = renderNumber(
+        text_cache, "p50 ", p50[row] + 0.5f, TEXT_COLOR,
+        &(Vector2D){.x = bars_x + PROFILER_BAR_WIDTH + PROFILER_MARGIN, .y = y},
+        font);
+    renderNumber(text_cache, "  p99 ", p99[row] + 0.5f, TEXT_COLOR,
+                 &(Vector2D){.x = x, .y = y}, font);
+  }
+}
+
+/******* INPUT RECORDING ********/
+
+// A recording stores the seed, the level and the input of every frame. Frames
+// with the same input as the frame before are only counted:
+//   header: "COUT" version varint(seed) varint(balls) varint(cols)
+//           varint(rows) varint(particles)
+//   record: varint(repeat) flags [zigzag varint(mouse_x - previous mouse_x)]
+// repeat is the number of frames the previous input was repeated before the
+// input of the record changed. The last record has the flags INPUT_END.
+#define RECORDING_MAGIC "COUT"
+#define RECORDING_VERSION 4
+
+enum {
+  INPUT_A = 1 << 0,
+  INPUT_D = 1 << 1,
+  INPUT_TOGGLE_PAUSE = 1 << 2,
+  INPUT_RESET = 1 << 3,
+  INPUT_MOUSE = 1 << 4, // mouse_x changed, the delta follows
+  INPUT_END = 0xFF,
+};
+
+#define NO_INPUT ((GameInput){.mouse_x = -1})
+
+typedef struct InputRecorder_s {
+  FILE *file;
+  GameInput last;
+  uint64_t repeat;
+  uint64_t frames;
+} InputRecorder;
+
+typedef struct InputPlayer_s {
+  FILE *file;
+  GameInput current;
+  GameInput next;
+  bool has_next;
+  bool end;
+  uint64_t remaining; // frames left with the current input
+  uint64_t seed;
+  Level level;
+} InputPlayer;
+
+void writeVarint(FILE *const file, uint64_t value) {
+  while (value >= 0x80) {
+    fputc((value & 0x7F) | 0x80, file);
+    value >>= 7;
+  }
+  fputc(value, file);
+}
+
+bool readVarint(FILE *const file, uint64_t *const value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int c = fgetc(file);
+    if (c == EOF)
+      return false;
+    *value |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+uint64_t zigzagEncode(const int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t zigzagDecode(const uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+uint8_t inputFlags(const GameInput *const input) {
+  return (input->a_pressed ? INPUT_A : 0) | (input->d_pressed ? INPUT_D : 0) |
+         (input->toggle_pause ? INPUT_TOGGLE_PAUSE : 0) |
+         (input->reset ? INPUT_RESET : 0);
+}
+
+int openRecorder(InputRecorder *const recorder, const char *const path,
+                 const uint64_t seed, const Level *const level) {
+  recorder->file = fopen(path, "wb");
+  if (!recorder->file) {
+    SDL_Log("Unable to open recording %s for writing", path);
+    return -1;
+  }
+  fwrite(RECORDING_MAGIC, 1, strlen(RECORDING_MAGIC), recorder->file);
+  fputc(RECORDING_VERSION, recorder->file);
+  writeVarint(recorder->file, seed);
+  writeVarint(recorder->file, level->ball_capacity);
+  writeVarint(recorder->file, level->cols);
+  writeVarint(recorder->file, level->rows);
+  writeVarint(recorder->file, level->particle_capacity);
+  recorder->last = NO_INPUT;
+  recorder->repeat = 0;
+  recorder->frames = 0;
+  return 0;
+}
+
+void recordInput(InputRecorder *const recorder, const GameInput *const input) {
+  recorder->frames++;
+  const GameInput *const last = &recorder->last;
+  const uint8_t flags = inputFlags(input);
+  const bool mouse_changed = input->mouse_x != last->mouse_x;
+  if (flags == inputFlags(last) && !mouse_changed) {
+    recorder->repeat++;
+    return;
+  }
+  writeVarint(recorder->file, recorder->repeat);
+  fputc(flags | (mouse_changed ? INPUT_MOUSE : 0), recorder->file);
+  if (mouse_changed)
+    writeVarint(recorder->file,
+                zigzagEncode((int64_t)input->mouse_x - last->mouse_x));
+  recorder->last = *input;
+  recorder->repeat = 0;
+}
+
+int closeRecorder(InputRecorder *const recorder) {
+  if (!recorder->file)
+    return 0;
+  writeVarint(recorder->file, recorder->repeat);
+  fputc(INPUT_END, recorder->file);
+  const bool failed =
+      (ferror(recorder->file) != 0) | (fclose(recorder->file) != 0);
+  recorder->file = NULL;
+  if (failed) {
+    SDL_Log("Unable to write the recording");
+    return -1;
+  }
+  SDL_Log("Recorded %" PRIu64 " frames", recorder->frames);
+  return 0;
+}
+
+int openPlayer(InputPlayer *const player, const char *const path) {
+  *player = (InputPlayer){.current = NO_INPUT, .next = NO_INPUT};
+  player->file = fopen(path, "rb");
+  if (!player->file) {
+    SDL_Log("Unable to open recording %s", path);
+    return -1;
+  }
+  char magic[sizeof(RECORDING_MAGIC) - 1];
+  uint64_t balls = 0;
+  uint64_t cols = 0;
+  uint64_t rows = 0;
+  uint64_t particles = 0;
+  if (fread(magic, 1, sizeof(magic), player->file) != sizeof(magic) ||
+      memcmp(magic, RECORDING_MAGIC, sizeof(magic)) ||
+      fgetc(player->file) != RECORDING_VERSION ||
+      !readVarint(player->file, &player->seed) ||
+      !readVarint(player->file, &balls) || balls < 1 || balls > MAX_BALLS ||
+      !readVarint(player->file, &cols) || cols < 1 ||
+      cols > MAX_TARGET_DIMENSION || !readVarint(player->file, &rows) ||
+      rows < 1 || rows > MAX_TARGET_DIMENSION ||
+      !readVarint(player->file, &particles) ||
+      particles > MAX_PARTICLE_NUMBER) {
+    SDL_Log("%s is not a valid recording", path);
+    fclose(player->file);
+    player->file = NULL;
+    return -1;
+  }
+  player->level = initialLevel(cols, rows, particles, balls);
+  return 0;
+}
+
+// Reads the next record. Returns false at the end or on a corrupt file.
+bool readRecord(InputPlayer *const player) {
+  if (player->end)
+    return false;
+  uint64_t repeat = 0;
+  const bool has_repeat = readVarint(player->file, &repeat);
+  const int flags = fgetc(player->file);
+  if (!has_repeat || flags == EOF ||
+      (flags != INPUT_END && (flags & ~0x1F))) {
+    SDL_Log("The recording is truncated or corrupt");
+    player->end = true;
+    return false;
+  }
+  player->remaining = repeat;
+  if (flags == INPUT_END) {
+    player->end = true;
+    return true;
+  }
+  GameInput next = {
+      .a_pressed = (flags & INPUT_A) != 0,
+      .d_pressed = (flags & INPUT_D) != 0,
+      .toggle_pause = (flags & INPUT_TOGGLE_PAUSE) != 0,
+      .reset = (flags & INPUT_RESET) != 0,
+      .mouse_x = player->next.mouse_x,
+  };
+  uint64_t delta = 0;
+  if (flags & INPUT_MOUSE) {
+    if (!readVarint(player->file, &delta)) {
+      SDL_Log("The recording is truncated or corrupt");
+      player->end = true;
+      return false;
+    }
+    next.mouse_x += zigzagDecode(delta);
+  }
+  player->next = next;
+  player->has_next = true;
+  return true;
+}
+
+// Gets the input of the next frame. Returns false after the last frame.
+bool nextInput(InputPlayer *const player, GameInput *const input) {
+  for (;;) {
+    if (player->remaining > 0) {
+      player->remaining--;
+      *input = player->current;
+      return true;
+    }
+    if (player->has_next) {
+      player->current = player->next;
+      player->has_next = false;
+      player->remaining = 1;
+      continue;
+    }
+    if (!readRecord(player))
+      return false;
+  }
+}
+
+void closePlayer(InputPlayer *const player) {
+  if (player->file)
+    fclose(player->file);
+  player->file = NULL;
 }
 
-void drawProj(const Projectile *const proj, SDL_Renderer *const renderer) {
-  SDL_Rect rect = createProjRect(proj);
-  SDL_SetRenderDrawColor(renderer, SPREAD_COLOR(PROJ_COLOR));
-  SDL_RenderFillRect(renderer, &rect);
+/******* AUTOPLAYER ********/
+
+// The autoplayer steers the bar with the A and D keys, so its input can be
+// recorded and replayed like the input of a player. It predicts where the next
+// ball reaches the top of the bar, folding its flight at the walls, and moves
+// the bar there. While a ball goes up any target can send it back, so the bar
+// stays below it instead; the bar is about as fast as the ball, so it can
+// follow wherever the ball comes down from.
+//
+// A moving bar sends the ball in its direction, which is the only way to aim.
+// The ball always flies diagonally, so always sending it towards the target
+// can cycle forever without touching the last targets. Instead the autoplayer
+// searches the shortest sequence of directions after which the ball flies
+// through the lowest remaining target and moves the bar in the first one
+// during the last frames before the contact.
+#define AUTOPLAY_STEER_FRAMES 3
+#define AUTOPLAY_PLAN_DEPTH 10 // contacts with the bar that are planned ahead
+
+typedef struct Autoplayer_s {
+  uint32_t generation; // of the targets when word was searched
+  uint32_t word;       // no target is alive in this word or above
+  float plan_x;        // contact for which plan_direction was searched
+  uint32_t plan_target;
+  int32_t plan_direction;
+} Autoplayer;
+
+Autoplayer initialAutoplayer(void) {
+  return (Autoplayer){.generation = 0, .word = UINT32_MAX, .plan_x = NAN};
 }
 
-int readHighscore(uint64_t *const highscore) {
-  FILE *file = fopen(HIGHSCORE_FILE_NAME, "r");
-  if (!file)
+// Reflects x at 0 and at width until it is in [0, width]
+float foldIntoRange(const float x, const float width) {
+  if (width <= 0)
+    return 0;
+  float folded = fmodf(x, 2 * width);
+  folded = folded < 0 ? folded + 2 * width : folded;
+  return folded > width ? 2 * width - folded : folded;
+}
+
+// Returns the number of frames until the ball reaches the top of the bar, if
+// it only bounces off the walls and the ceiling, or INFINITY if it is already
+// below it. contact_x is its x at that moment.
+float predictBarContact(const Projectile *const proj, const Level *const level,
+                        const float bar_y, float *const contact_x) {
+  const float contact_y = bar_y - level->proj_height;
+  if (proj->vel.y == 0 || proj->pos.y > contact_y)
+    return INFINITY;
+  const float distance = proj->vel.y > 0 ? contact_y - proj->pos.y
+                                         : proj->pos.y + contact_y;
+  const float seconds = distance / fabsf(proj->vel.y);
+  *contact_x = foldIntoRange(proj->pos.x + proj->vel.x * seconds,
+                             level->width - level->proj_width);
+  return seconds * FPS;
+}
+
+// Finds the alive target with the highest index, the right-most one of the
+// lowest row. The search continues where the last one stopped, because targets
+// only come back when the generation changes.
+bool lowestTarget(Autoplayer *const bot, const Targets *const targets,
+                  uint32_t *const idx) {
+  const uint32_t words = targets->level->target_words;
+  if (bot->generation != targets->generation || bot->word > words) {
+    bot->generation = targets->generation;
+    bot->word = words;
+  }
+  while (bot->word > 0 && !targets->alive[bot->word - 1])
+    bot->word--;
+  if (bot->word == 0)
+    return false;
+  const uint64_t bits = targets->alive[bot->word - 1];
+  *idx = (bot->word - 1) * 64 + 63 - __builtin_clzll(bits);
+  return true;
+}
+
+// Whether a ball that leaves the top of the bar at x towards direction flies
+// through box on its way up or, after the ceiling, on its way down. Other
+// targets are ignored.
+bool flightHits(const float x, const int32_t direction, const float contact_y,
+                const SDL_FRect *const box, const Level *const level) {
+  const float width = level->width - level->proj_width;
+  const float distances[] = {
+      contact_y - (box->y + box->h),            // up to the bottom of the box
+      contact_y + box->y - level->proj_height, // up and down to its top
+  };
+  for (int32_t i = 0; i < 2; i++) {
+    if (distances[i] < 0)
+      continue;
+    const float bx = foldIntoRange(x + direction * distances[i], width);
+    if (bx + level->proj_width > box->x && bx < box->x + box->w)
+      return true;
+  }
+  return false;
+}
+
+// Returns the first direction of the shortest sequence of bar contacts after
+// which a ball leaving the bar at x hits box, or 0 if there is none.
+int32_t planDirection(const float x, const float contact_y,
+                      const SDL_FRect *const box, const Level *const level) {
+  const float width = level->width - level->proj_width;
+  for (int32_t length = 1; length <= AUTOPLAY_PLAN_DEPTH; length++) {
+    for (uint32_t path = 0; path < 1u << length; path++) {
+      float contact_x = x;
+      for (int32_t i = 0; i + 1 < length; i++) {
+        const int32_t direction = (path >> i) & 1 ? 1 : -1;
+        contact_x = foldIntoRange(contact_x + direction * 2 * contact_y, width);
+      }
+      const int32_t last = (path >> (length - 1)) & 1 ? 1 : -1;
+      if (flightHits(contact_x, last, contact_y, box, level))
+        return path & 1 ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+GameInput autoplayInput(Autoplayer *const bot, const Game *const game) {
+  GameInput input = NO_INPUT;
+  if (!game->started) {
+    input.d_pressed = true;
+    return input;
+  }
+  if (game->won || game->lost) {
+    input.reset = true;
+    return input;
+  }
+
+  const Level *const level = &game->level;
+  const Bar *const bar = &game->bar;
+  float frames = INFINITY;
+  float contact_x = 0;
+  for (int32_t i = 0; i < game->balls.count; i++) {
+    const Projectile *const proj = &game->balls.proj[i];
+    float x = 0;
+    const float f = predictBarContact(proj, level, bar->pos.y, &x);
+    if (f < frames) {
+      frames = f;
+      contact_x = proj->vel.y < 0 ? proj->pos.x : x;
+    }
+  }
+  if (isinf(frames))
+    return input;
+
+  const float ball_center = contact_x + level->proj_width / 2.0f;
+  int32_t direction = 0;
+  uint32_t idx;
+  if (lowestTarget(bot, &game->targets, &idx)) {
+    const Vector2D target = targetPos(level, idx);
+    if (frames < AUTOPLAY_STEER_FRAMES &&
+        (contact_x != bot->plan_x || idx != bot->plan_target)) {
+      const SDL_FRect box = {target.x, target.y, TARGET_WIDTH, TARGET_HEIGHT};
+      bot->plan_x = contact_x;
+      bot->plan_target = idx;
+      bot->plan_direction =
+          planDirection(contact_x, bar->pos.y - level->proj_height, &box,
+                        level);
+    }
+    direction = frames < AUTOPLAY_STEER_FRAMES && bot->plan_direction
+                    ? bot->plan_direction
+                    : target.x + TARGET_WIDTH / 2.0f < ball_center ? -1 : 1;
+  }
+
+  const float bar_center = bar->pos.x + level->bar_width / 2.0f;
+  const float step = level->bar_speed * DELTA_TIME_SEC;
+  // Only steer if the ball still lands on the bar after it moved
+  const float steered = bar_center + direction * step * ceilf(frames);
+  const bool steer = frames < AUTOPLAY_STEER_FRAMES &&
+                     fabsf(steered - ball_center) < level->bar_width / 2.0f;
+  int32_t move = direction;
+  if (!steer) {
+    // Catch the ball on the side that lets the bar steer, if it gets there
+    float aim = ball_center - direction * (level->bar_width / 4.0f);
+    if (frames < AUTOPLAY_STEER_FRAMES ||
+        fabsf(aim - bar_center) > step * (frames - AUTOPLAY_STEER_FRAMES))
+      aim = ball_center;
+    const float offset = aim - bar_center;
+    move = offset > step / 2 ? 1 : offset < -step / 2 ? -1 : 0;
+  }
+  input.a_pressed = move < 0;
+  input.d_pressed = move > 0;
+  return input;
+}
+
+/******* SIMULATION THREAD ********/
+
+// The simulation runs on its own thread at FPS steps per second, so a slow
+// frame on the render thread does not delay the physics and the input. After
+// every step the drawn state is copied into a snapshot, which is handed to the
+// render thread through a lock-free triple buffer: the simulation owns one
+// snapshot to write, the render thread owns one to read and the third one is
+// exchanged atomically. The render thread always gets the newest complete
+// snapshot and neither side ever waits for the other.
+#define SNAPSHOT_FRESH 4 // set in the shared index until the snapshot is read
+
+typedef struct GameSnapshot_s {
+  Game game;          // only the state used by drawGame is copied
+  SimTimings timings; // of the step that produced the snapshot
+} GameSnapshot;
+
+typedef struct TripleBuffer_s {
+  GameSnapshot snapshots[3];
+  SDL_atomic_t shared; // index of the exchanged snapshot | SNAPSHOT_FRESH
+  int32_t write;       // owned by the simulation
+  int32_t read;        // owned by the render thread
+} TripleBuffer;
+
+// Copies the state that drawGame uses. Both games must have the same level.
+void copyGameSnapshot(Game *const dst, const Game *const src) {
+  dst->pause = src->pause;
+  dst->started = src->started;
+  dst->won = src->won;
+  dst->lost = src->lost;
+  dst->score = src->score;
+  dst->highscore = src->highscore;
+  dst->bar = src->bar;
+
+  dst->balls.count = src->balls.count;
+  memcpy(dst->balls.proj, src->balls.proj,
+         sizeof(Projectile) * src->balls.count);
+
+  const Level *const level = &src->level;
+  Targets *const targets = &dst->targets;
+  memcpy(targets->alive, src->targets.alive,
+         sizeof(uint64_t) * level->target_words);
+  memcpy(targets->row_colors, src->targets.row_colors,
+         sizeof(color_t) * level->rows);
+  memcpy(targets->kill_log, src->targets.kill_log,
+         sizeof(targets->kill_log));
+  targets->alive_count = src->targets.alive_count;
+  targets->generation = src->targets.generation;
+  targets->kills = src->targets.kills;
+
+  const int32_t count = src->particles.count;
+  Particles *const particles = &dst->particles;
+  particles->count = count;
+  memcpy(particles->x, src->particles.x, sizeof(float) * count);
+  memcpy(particles->y, src->particles.y, sizeof(float) * count);
+  memcpy(particles->alpha, src->particles.alpha, sizeof(float) * count);
+  memcpy(particles->size, src->particles.size, sizeof(int32_t) * count);
+  memcpy(particles->color, src->particles.color, sizeof(color_t) * count);
+}
+
+bool initializeTripleBuffer(TripleBuffer *const buffer, const Game *const game) {
+  for (int32_t i = 0; i < 3; i++) {
+    if (!initializeGame(&buffer->snapshots[i].game, &game->level, 0))
+      return false;
+    copyGameSnapshot(&buffer->snapshots[i].game, game);
+    buffer->snapshots[i].timings = (SimTimings){0};
+  }
+  buffer->write = 0;
+  SDL_AtomicSet(&buffer->shared, 1);
+  buffer->read = 2;
+  return true;
+}
+
+void freeTripleBuffer(TripleBuffer *const buffer) {
+  for (int32_t i = 0; i < 3; i++)
+    freeGame(&buffer->snapshots[i].game);
+}
+
+GameSnapshot *snapshotToWrite(TripleBuffer *const buffer) {
+  return &buffer->snapshots[buffer->write];
+}
+
+void publishSnapshot(TripleBuffer *const buffer) {
+  SDL_MemoryBarrierRelease(); // the snapshot is complete before it is shared
+  const int previous =
+      SDL_AtomicSet(&buffer->shared, buffer->write | SNAPSHOT_FRESH);
+  buffer->write = previous & ~SNAPSHOT_FRESH;
+}
+
+// Returns the newest snapshot, which is not changed until the next call.
+const GameSnapshot *latestSnapshot(TripleBuffer *const buffer) {
+  if (SDL_AtomicGet(&buffer->shared) & SNAPSHOT_FRESH) {
+    const int previous = SDL_AtomicSet(&buffer->shared, buffer->read);
+    SDL_MemoryBarrierAcquire();
+    buffer->read = previous & ~SNAPSHOT_FRESH;
+  }
+  return &buffer->snapshots[buffer->read];
+}
+
+typedef struct SimThread_s {
+  SDL_Thread *thread; // NULL if the simulation runs on the render thread
+  SDL_atomic_t running;
+  SDL_SpinLock input_lock;
+  GameInput input; // the latest input, guarded by input_lock
+  bool autoplay;    // the autoplayer moves the bar instead of the player
+  Autoplayer bot;
+  Game *game;
+  InputRecorder *recorder;
+  TripleBuffer *buffer;
+  SDL_atomic_t quality; // level set by the quality governor
+  ScoreWriter *scores;  // NULL if the scores are not saved
+  bool round_over;
+} SimThread;
+
+// Hands the input of a rendered frame to the simulation. Presses of pause and
+// reset and mouse drags are kept until the next step takes them, so none are
+// lost when several frames are rendered per step.
+void postInput(SimThread *const sim, const GameInput *const input) {
+  SDL_AtomicLock(&sim->input_lock);
+  sim->input.a_pressed = input->a_pressed;
+  sim->input.d_pressed = input->d_pressed;
+  if (input->mouse_x > 0)
+    sim->input.mouse_x = input->mouse_x;
+  sim->input.toggle_pause ^= input->toggle_pause;
+  sim->input.reset |= input->reset;
+  SDL_AtomicUnlock(&sim->input_lock);
+}
+
+GameInput takeInput(SimThread *const sim) {
+  SDL_AtomicLock(&sim->input_lock);
+  const GameInput input = sim->input;
+  sim->input.mouse_x = -1;
+  sim->input.toggle_pause = false;
+  sim->input.reset = false;
+  SDL_AtomicUnlock(&sim->input_lock);
+  return input;
+}
+
+void simStep(SimThread *const sim) {
+  TRACE_ZONE("simStep");
+  GameInput input = takeInput(sim);
+  if (sim->autoplay) {
+    const GameInput bot = autoplayInput(&sim->bot, sim->game);
+    input.a_pressed = bot.a_pressed;
+    input.d_pressed = bot.d_pressed;
+    input.mouse_x = bot.mouse_x;
+    input.reset |= bot.reset;
+  }
+  if (sim->recorder->file)
+    recordInput(sim->recorder, &input);
+  GameSnapshot *const snapshot = snapshotToWrite(sim->buffer);
+  snapshot->timings = (SimTimings){0};
+  // Only changes the particles, which are not part of the recorded state
+  sim->game->particles.quality = SDL_AtomicGet(&sim->quality);
+  stepGame(sim->game, &input, &snapshot->timings);
+  copyGameSnapshot(&snapshot->game, sim->game);
+  publishSnapshot(sim->buffer);
+  // Every round is saved when it ends, so a crash later loses no score
+  const bool round_over = sim->game->won || sim->game->lost;
+  if (sim->scores && round_over && !sim->round_over && sim->game->score > 0)
+    submitScore(sim->scores, sim->game->score);
+  sim->round_over = round_over;
+}
+
+int simulate(void *const data) {
+  SimThread *const sim = data;
+  FramePacer pacer = initialFramePacer(PACING_CAPPED);
+  while (SDL_AtomicGet(&sim->running)) {
+    simStep(sim);
+    pacerEndFrame(&pacer);
+  }
+  return 0;
+}
+
+// Starts the simulation thread. If threads are not available the render
+// thread has to call simStep once per frame instead.
+void startSimThread(SimThread *const sim, Game *const game,
+                    InputRecorder *const recorder, TripleBuffer *const buffer,
+                    ScoreWriter *const scores, const bool autoplay) {
+  *sim = (SimThread){
+      .input = NO_INPUT,
+      .autoplay = autoplay,
+      .bot = initialAutoplayer(),
+      .game = game,
+      .recorder = recorder,
+      .buffer = buffer,
+      .scores = scores,
+  };
+  SDL_AtomicSet(&sim->running, 1);
+#if !FOR_WASM
+  sim->thread = SDL_CreateThread(simulate, "simulation", sim);
+  if (!sim->thread)
+    SDL_Log("Unable to start the simulation thread, simulating on the render "
+            "thread: %s",
+            SDL_GetError());
+#endif
+}
+
+void stopSimThread(SimThread *const sim) {
+  SDL_AtomicSet(&sim->running, 0);
+  if (sim->thread)
+    SDL_WaitThread(sim->thread, NULL);
+  sim->thread = NULL;
+}
+
+/******* COMMAND LINE ********/
+
+#define DEFAULT_HEADLESS_FRAMES 10000
+#define MAX_BATCH_GAMES (1 << 24)
+
+typedef struct Options_s {
+  bool headless;
+  bool autoplay; // the bar is moved by the autoplayer
+  uint64_t frames; // number of simulated frames in headless mode
+  PacingMode pacing;
+  bool adaptive_quality; // the quality governor may lower the quality
+  int32_t balls;
+  int32_t cols;
+  int32_t rows;
+  int32_t particles;
+  int32_t jobs; // worker threads of the job pool, -1 for one per extra core
+  uint64_t seed;
+  const char *record; // file to record the input to, or NULL
+  const char *replay; // recording to replay headless, or NULL
+  int32_t batch;      // number of games to play headless in parallel, or 0
+  const char *csv;    // file for the results of the batch, or NULL
+} Options;
+
+Options defaultOptions(void) {
+  return (Options){
+      .headless = false,
+      .autoplay = false,
+      .frames = DEFAULT_HEADLESS_FRAMES,
+      .pacing = PACING_CAPPED,
+      .adaptive_quality = true,
+      .balls = 1,
+      .cols = DEFAULT_TARGET_X_NUMBER,
+      .rows = DEFAULT_TARGET_Y_NUMBER,
+      .particles = DEFAULT_PARTICLE_NUMBER,
+      .jobs = -1,
+      .seed = DEFAULT_SEED,
+      .record = NULL,
+      .replay = NULL,
+      .batch = 0,
+      .csv = NULL,
+  };
+}
+
+void printUsage(const char *const program) {
+  fprintf(stderr,
+          "Usage: %s [--headless] [--autoplay] [--frames N] [--pacing MODE]\n"
+          "          [--quality MODE] [--balls N] [--cols N] [--rows N]\n"
+          "          [--particles N] [--seed N] [--jobs N] [--record FILE]\n"
+          "          [--replay FILE] [--batch N] [--csv FILE]\n"
+          "  --headless  run the simulation without a window and without a "
+          "frame cap\n"
+          "  --autoplay  let the autoplayer move the bar\n"
+          "  --frames N  number of frames to simulate in headless mode "
+          "(default: %d)\n"
+          "  --pacing MODE  frame pacing: capped (default), uncapped or "
+          "vsync\n"
+          "  --quality MODE  particle quality: auto (default) lowers it when "
+          "frames run\n"
+          "              over budget, full keeps it\n"
+          "  --balls N   play with N balls at once (1 to %d)\n"
+          "  --cols N    number of target columns (1 to %d, default: %d)\n"
+          "  --rows N    number of target rows (1 to %d, default: %d)\n"
+          "  --particles N  maximal number of particles (default: %d)\n"
+          "  --jobs N    worker threads for parallel loops, 0 runs them "
+          "serially\n"
+          "  --seed N    seed of the random number generator\n"
+          "  --record FILE  record the input of every frame to FILE\n"
+          "  --replay FILE  replay a recording headless as fast as possible\n"
+          "  --batch N   play N games with the seeds --seed, --seed + 1, ... "
+          "headless on\n"
+          "              all cores, each for at most --frames frames\n"
+          "  --csv FILE  write the result of every game of the batch to FILE\n",
+          program, DEFAULT_HEADLESS_FRAMES, MAX_BALLS, MAX_TARGET_DIMENSION,
+          DEFAULT_TARGET_X_NUMBER, MAX_TARGET_DIMENSION,
+          DEFAULT_TARGET_Y_NUMBER, DEFAULT_PARTICLE_NUMBER);
+}
+
+int parseOptions(const int argc, char **const argv, Options *const options) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--headless")) {
+      options->headless = true;
+    } else if (!strcmp(argv[i], "--autoplay")) {
+      options->autoplay = true;
+    } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+      char *end = NULL;
+      options->frames = strtoull(argv[++i], &end, 10);
+      if (*end != '\0' || options->frames == 0) {
+        fprintf(stderr, "Invalid number of frames: %s\n", argv[i]);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--balls") && i + 1 < argc) {
+      char *end = NULL;
+      const long balls = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || balls < 1 || balls > MAX_BALLS) {
+        fprintf(stderr, "Invalid number of balls: %s\n", argv[i]);
+        return -1;
+      }
+      options->balls = balls;
+    } else if ((!strcmp(argv[i], "--cols") || !strcmp(argv[i], "--rows")) &&
+               i + 1 < argc) {
+      const bool cols = !strcmp(argv[i], "--cols");
+      char *end = NULL;
+      const long number = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || number < 1 || number > MAX_TARGET_DIMENSION) {
+        fprintf(stderr, "Invalid number of %s: %s\n", cols ? "columns" : "rows",
+                argv[i]);
+        return -1;
+      }
+      *(cols ? &options->cols : &options->rows) = number;
+    } else if (!strcmp(argv[i], "--particles") && i + 1 < argc) {
+      char *end = NULL;
+      const long particles = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || particles < 0 || particles > MAX_PARTICLE_NUMBER) {
+        fprintf(stderr, "Invalid number of particles: %s\n", argv[i]);
+        return -1;
+      }
+      options->particles = particles;
+    } else if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+      char *end = NULL;
+      const long jobs = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || jobs < 0 || jobs > MAX_JOB_WORKERS) {
+        fprintf(stderr, "Invalid number of jobs: %s\n", argv[i]);
+        return -1;
+      }
+      options->jobs = jobs;
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      char *end = NULL;
+      options->seed = strtoull(argv[++i], &end, 0);
+      if (*end != '\0') {
+        fprintf(stderr, "Invalid seed: %s\n", argv[i]);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+      char *end = NULL;
+      const long batch = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || batch < 1 || batch > MAX_BATCH_GAMES) {
+        fprintf(stderr, "Invalid number of games: %s\n", argv[i]);
+        return -1;
+      }
+      options->batch = batch;
+    } else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+      options->csv = argv[++i];
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      options->record = argv[++i];
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      options->replay = argv[++i];
+    } else if (!strcmp(argv[i], "--pacing") && i + 1 < argc) {
+      const char *const mode = argv[++i];
+      if (!strcmp(mode, "capped")) {
+        options->pacing = PACING_CAPPED;
+      } else if (!strcmp(mode, "uncapped")) {
+        options->pacing = PACING_UNCAPPED;
+      } else if (!strcmp(mode, "vsync")) {
+        options->pacing = PACING_VSYNC;
+      } else {
+        fprintf(stderr, "Invalid pacing mode: %s\n", mode);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--quality") && i + 1 < argc) {
+      const char *const mode = argv[++i];
+      if (!strcmp(mode, "auto")) {
+        options->adaptive_quality = true;
+      } else if (!strcmp(mode, "full")) {
+        options->adaptive_quality = false;
+      } else {
+        fprintf(stderr, "Invalid quality mode: %s\n", mode);
+        return -1;
+      }
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return -1;
+    }
+  }
+  if (options->record &&
+      (options->headless || options->replay || options->batch)) {
+    fprintf(stderr, "Only an interactive game can be recorded\n");
+    return -1;
+  }
+  if (options->csv && !options->batch) {
+    fprintf(stderr, "Only the results of a batch can be written to a CSV\n");
     return -1;
+  }
+  return 0;
+}
+
+Level optionsLevel(const Options *const options) {
+  return initialLevel(options->cols, options->rows, options->particles,
+                      options->balls);
+}
+
+/******* GAME LOOP ********/
+
+void printSimReport(const uint64_t frames, const uint64_t rounds,
+                    const uint64_t ticks, const SimTimings *const timings) {
+  const double ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+  const double seconds = ticks * ns_per_tick / 1e9;
+  printf("Simulated %" PRIu64 " frames (%" PRIu64 " rounds) in %.3f s: "
+         "%.0f frames/s, %.1f ns/frame\n",
+         frames, rounds, seconds, frames / seconds, ticks * ns_per_tick / frames);
+  for (int phase = 0; phase < SIM_PHASE_COUNT; phase++) {
+    printf("  %-16s %10.1f ns/frame\n", SIM_PHASE_NAMES[phase],
+           timings->ticks[phase] * ns_per_tick / frames);
+  }
+}
+
+// FNV-1a over the parts of the state that the simulation changes
+uint32_t hashGameState(const Game *const game) {
+  uint32_t hash = 2166136261u;
+#define HASH_BYTES(ptr, size)                                                  \
+  for (size_t i_ = 0; i_ < (size); i_++) {                                     \
+    hash ^= ((const uint8_t *)(ptr))[i_];                                      \
+    hash *= 16777619u;                                                         \
+  }
+  HASH_BYTES(&game->score, sizeof(game->score));
+  HASH_BYTES(game->targets.alive,
+             sizeof(uint64_t) * game->level.target_words);
+  HASH_BYTES(&game->bar.pos, sizeof(game->bar.pos));
+  HASH_BYTES(&game->balls.count, sizeof(game->balls.count));
+  HASH_BYTES(game->balls.proj, game->balls.count * sizeof(Projectile));
+#undef HASH_BYTES
+  return hash;
+}
+
+// Every this many frames an autoplayed headless run reports its progress
+#define AUTOPLAY_REPORT_FRAMES (10 * 60 * FPS)
+
+// Runs the simulation without any window, renderer or frame cap and reports
+// the simulated frames per second and the time spent in each phase. With the
+// autoplayer the progress is reported regularly, so long runs show drifting
+// frame times.
+int runHeadless(const Options *const options) {
+  Game game;
+  Autoplayer bot = initialAutoplayer();
+  GameInput input = {0};
+  SimTimings timings = {0};
+  uint64_t rounds = 1;
+  uint64_t won = 0;
+
+  const Level level = optionsLevel(options);
+  if (!initializeGame(&game, &level, options->seed)) {
+    SDL_Log("Unable to allocate the level");
+    return 1;
+  }
+  game.random_serve = true;
+  placeServe(&game);
+  game.started = true;
+
+  const uint64_t start = SDL_GetPerformanceCounter();
+  uint64_t report_start = start;
+  for (uint64_t frame = 0; frame < options->frames; frame++) {
+    if (game.won || game.lost) {
+      won += game.won;
+      resetGame(&game);
+      game.started = true;
+      rounds++;
+    }
+    if (options->autoplay) {
+      input = autoplayInput(&bot, &game);
+      if ((frame + 1) % AUTOPLAY_REPORT_FRAMES == 0) {
+        const uint64_t now = SDL_GetPerformanceCounter();
+        printf("Frame %" PRIu64 ": %" PRIu64 " of %" PRIu64
+               " rounds won, %.1f ns/frame\n",
+               frame + 1, won, rounds - 1,
+               (now - report_start) * 1e9 / SDL_GetPerformanceFrequency() /
+                   AUTOPLAY_REPORT_FRAMES);
+        report_start = now;
+      }
+    }
+    stepGame(&game, &input, &timings);
+  }
+  const uint64_t ticks = SDL_GetPerformanceCounter() - start;
+
+  printSimReport(options->frames, rounds, ticks, &timings);
+  if (options->autoplay)
+    printf("Won %" PRIu64 " of %" PRIu64 " finished rounds\n", won, rounds - 1);
+  freeGame(&game);
+  return 0;
+}
+
+// Replays a recording as fast as possible. The final score and a hash of the
+// game state are printed, so two runs can be compared for regressions.
+int runReplay(const Options *const options) {
+  Game game;
+  InputPlayer player;
+  SimTimings timings = {0};
+  uint64_t frames = 0;
+  uint64_t rounds = 1;
 
-  char text_buf[TEXT_BUF_SIZE];
+  if (openPlayer(&player, options->replay))
+    return 1;
+  if (!initializeGame(&game, &player.level, player.seed)) {
+    SDL_Log("Unable to allocate the level");
+    closePlayer(&player);
+    return 1;
+  }
+
+  GameInput input;
+  const uint64_t start = SDL_GetPerformanceCounter();
+  while (nextInput(&player, &input)) {
+    rounds += input.reset;
+    stepGame(&game, &input, &timings);
+    frames++;
+  }
+  const uint64_t ticks = SDL_GetPerformanceCounter() - start;
+  closePlayer(&player);
 
-  char c;
-  size_t i = 0;
-  while (c = fgetc(file), c != EOF) {
-    text_buf[i] = c;
-    i++;
+  if (frames == 0) {
+    SDL_Log("The recording %s contains no frames", options->replay);
+    freeGame(&game);
+    return 1;
   }
-  // Other way to read file:
-  // while (fgets(text_buf, TEXT_BUF_SIZE, file)) {
-  // }
+  printSimReport(frames, rounds, ticks, &timings);
+  printf("Score %" PRIu64 ", highscore %" PRIu64 ", state hash %08" PRIx32
+         "\n",
+         game.score, game.highscore, hashGameState(&game));
+  freeGame(&game);
+  return player.end ? 0 : 1;
+}
+
+// Plays options->batch games headless with the seeds seed, seed + 1, ... on
+// one thread per core. Every game is played until it is won or lost, but at
+// most options->frames frames. The result of every game can be written to a
+// CSV file, a summary is printed.
+#define MAX_BATCH_THREADS 256
+
+typedef struct BatchGame_s {
+  uint64_t seed;
+  bool won;
+  uint64_t score;
+  uint64_t frames; // until the game was won or lost
+  uint64_t ticks;
+  SimTimings timings;
+} BatchGame;
+
+typedef struct Batch_s {
+  const Options *options;
+  Level level;
+  BatchGame *games;
+  int32_t count;
+  SDL_atomic_t next; // first game that no thread has taken yet
+  SDL_atomic_t failed;
+} Batch;
+
+void playBatchGame(Game *const game, const Options *const options,
+                   BatchGame *const result) {
+  Autoplayer bot = initialAutoplayer();
+  GameInput input = {0};
+  game->particles.random = seededRandom(result->seed);
+  resetGame(game);
+  game->started = true;
 
-  *highscore = atoi(text_buf);
+  const uint64_t start = SDL_GetPerformanceCounter();
+  uint64_t frame = 0;
+  for (; frame < options->frames && !game->won && !game->lost; frame++) {
+    if (options->autoplay)
+      input = autoplayInput(&bot, game);
+    stepGame(game, &input, &result->timings);
+  }
+  result->ticks = SDL_GetPerformanceCounter() - start;
+  result->won = game->won;
+  result->score = game->score;
+  result->frames = frame;
+}
 
+// Every thread owns one game and plays the games of the batch with it until
+// none are left.
+int playBatchGames(void *const data) {
+  Batch *const batch = data;
+  Game game;
+  if (!initializeGame(&game, &batch->level, 0)) {
+    SDL_AtomicSet(&batch->failed, 1);
+    return 1;
+  }
+  game.random_serve = true;
+  for (int32_t i; (i = SDL_AtomicAdd(&batch->next, 1)) < batch->count;)
+    playBatchGame(&game, batch->options, &batch->games[i]);
+  freeGame(&game);
   return 0;
 }
 
-void saveHighscore(const uint64_t highscore) {
-  FILE *file = fopen(HIGHSCORE_FILE_NAME, "w");
-  if (!file)
-    return;
-  char text_buf[TEXT_BUF_SIZE];
-  sprintf(text_buf, "%lu", highscore);
-  fputs(text_buf, file);
+int compareU64(const void *const a, const void *const b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
 }
 
-int runGame(void) {
+bool writeBatchCsv(const Batch *const batch, const char *const path) {
+  FILE *const file = fopen(path, "w");
+  if (!file) {
+    SDL_Log("Unable to open %s for writing", path);
+    return false;
+  }
+  const double ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+  fprintf(file, "seed,won,score,frames,ns_per_frame");
+  for (int phase = 0; phase < SIM_PHASE_COUNT; phase++)
+    fprintf(file, ",%s_ns_per_frame", SIM_PHASE_NAMES[phase]);
+  fprintf(file, "\n");
+  for (int32_t i = 0; i < batch->count; i++) {
+    const BatchGame *const game = &batch->games[i];
+    const double frames = game->frames ? game->frames : 1;
+    fprintf(file, "%" PRIu64 ",%d,%" PRIu64 ",%" PRIu64 ",%.1f", game->seed,
+            game->won, game->score, game->frames,
+            game->ticks * ns_per_tick / frames);
+    for (int phase = 0; phase < SIM_PHASE_COUNT; phase++)
+      fprintf(file, ",%.1f", game->timings.ticks[phase] * ns_per_tick / frames);
+    fprintf(file, "\n");
+  }
+  const bool failed = ferror(file);
+  if (fclose(file) || failed) {
+    SDL_Log("Unable to write %s", path);
+    return false;
+  }
+  return true;
+}
+
+void printBatchReport(const Batch *const batch, const int32_t threads,
+                      const uint64_t ticks) {
+  uint64_t *const frames_to_win = malloc(sizeof(uint64_t) * batch->count);
+  uint64_t won = 0;
+  uint64_t score = 0;
+  for (int32_t i = 0; i < batch->count; i++) {
+    score += batch->games[i].score;
+    if (batch->games[i].won && frames_to_win)
+      frames_to_win[won++] = batch->games[i].frames;
+  }
+
+  const double seconds = (double)ticks / SDL_GetPerformanceFrequency();
+  printf("Played %d games on %d threads in %.3f s: %.1f games/s\n",
+         batch->count, threads, seconds, batch->count / seconds);
+  printf("Won %" PRIu64 " (%.1f %%), mean score %.1f\n", won,
+         100.0 * won / batch->count, (double)score / batch->count);
+  if (won > 0) {
+    qsort(frames_to_win, won, sizeof(uint64_t), compareU64);
+    printf("Frames to win: min %" PRIu64 ", median %" PRIu64 ", p90 %" PRIu64
+           ", max %" PRIu64 "\n",
+           frames_to_win[0], frames_to_win[won / 2],
+           frames_to_win[won * 9 / 10], frames_to_win[won - 1]);
+  }
+  free(frames_to_win);
+}
+
+int runBatch(const Options *const options) {
+  Batch batch = {
+      .options = options,
+      .level = optionsLevel(options),
+      .games = calloc(options->batch, sizeof(BatchGame)),
+      .count = options->batch,
+  };
+  if (!batch.games) {
+    SDL_Log("Unable to allocate the batch");
+    return 1;
+  }
+  for (int32_t i = 0; i < batch.count; i++)
+    batch.games[i].seed = options->seed + i;
+
+  int32_t threads = options->jobs < 0 ? SDL_GetCPUCount() : options->jobs + 1;
+  threads = threads > MAX_BATCH_THREADS ? MAX_BATCH_THREADS : threads;
+  threads = threads > batch.count ? batch.count : threads;
+  SDL_Thread *handles[MAX_BATCH_THREADS];
+  int32_t started = 1; // the calling thread plays as well
+
+  const uint64_t start = SDL_GetPerformanceCounter();
+  for (; started < threads; started++) {
+    handles[started] = SDL_CreateThread(playBatchGames, "batch", &batch);
+    if (!handles[started]) {
+      SDL_Log("Unable to start a batch thread: %s", SDL_GetError());
+      break;
+    }
+  }
+  playBatchGames(&batch);
+  for (int32_t i = 1; i < started; i++)
+    SDL_WaitThread(handles[i], NULL);
+  const uint64_t ticks = SDL_GetPerformanceCounter() - start;
+
+  int result = 0;
+  if (SDL_AtomicGet(&batch.failed)) {
+    SDL_Log("Unable to allocate the level");
+    result = 1;
+  } else {
+    printBatchReport(&batch, started, ticks);
+    if (options->csv && !writeBatchCsv(&batch, options->csv))
+      result = 1;
+  }
+  free(batch.games);
+  return result;
+}
+
+int runGameWithOptions(const Options *const options) {
+  initializeColorTables();
+  if (options->batch)
+    return runBatch(options);
+  if (options->replay)
+    return runReplay(options);
+  if (options->headless)
+    return runHeadless(options);
+
   SDL_Window *window = NULL;
-  SDL_Renderer *renderer = NULL;
-  TTF_Font *game_font = NULL;
-  TTF_Font *score_font = NULL;
+  GameRenderer view = {0};
+  InputRecorder recorder = {0};
+  Game game = {0};
+  static TripleBuffer snapshots;
+  SimThread sim = {0};
+  ScoreWriter scores = {0};
+  FontLoader fonts = {0};
+  const Level level = optionsLevel(options);
 
   if (SDL_Init(SDL_INIT_VIDEO)) {
     SDL_Log("Unable to initialize SDL: %s", SDL_GetError());
@@ -634,6 +4400,7 @@ int runGame(void) {
     SDL_Log("Unable to initialize SDL_ttf: %s", TTF_GetError());
     EXIT();
   }
+  startFontLoader(&fonts);
 
   window = SDL_CreateWindow("Cout", 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, 0);
   if (!window) {
@@ -641,61 +4408,69 @@ int runGame(void) {
     EXIT();
   }
 
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  if (!renderer) {
+  const Uint32 renderer_flags =
+      SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE |
+      (options->pacing == PACING_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0);
+  view.renderer = SDL_CreateRenderer(window, -1, renderer_flags);
+  if (!view.renderer) {
     SDL_Log("Unable to create renderer: %s", SDL_GetError());
     EXIT();
   }
 
   // enable transparent mode
-  if (SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND)) {
+  if (SDL_SetRenderDrawBlendMode(view.renderer, SDL_BLENDMODE_BLEND)) {
     SDL_Log("Unable to set blend/transparent mode: %s", SDL_GetError());
     EXIT();
   }
 
-  const Uint8 *keyboard_state = SDL_GetKeyboardState(NULL);
-
-  game_font = TTF_OpenFont(FONT_FILEPATH, 28);
-  if (!game_font) {
-    SDL_Log("Unable to load font: %s", TTF_GetError());
+  initializeTextCache(&view.text_cache, view.renderer);
+  createTargetLayer(&view.target_layer, view.renderer);
+  if (!initializeGeometryBatch(&view.batches.opaque, view.renderer,
+                               SDL_BLENDMODE_NONE,
+                               level.target_number + 1 + level.ball_capacity) ||
+      !initializeGeometryBatch(&view.batches.blended, view.renderer,
+                               SDL_BLENDMODE_BLEND, level.particle_capacity)) {
+    SDL_Log("Unable to allocate the geometry batches");
     EXIT();
   }
 
-  score_font = TTF_OpenFont(FONT_FILEPATH, 20);
-  if (!score_font) {
-    SDL_Log("Unable to load font: %s", TTF_GetError());
-    EXIT();
-  }
+  const Uint8 *keyboard_state = SDL_GetKeyboardState(NULL);
 
   /******* State of the game *******/
   bool quit = false;
-  bool pause = false;
-  bool started = false;
   bool reset = false;
-  bool won = false;
-  bool lost = false;
-  uint64_t score = 0;
-  uint64_t highscore = 0;
-  Bar bar = initialBar();
-  Projectile proj = initialProj();
-  Target targets[TARGET_NUMBER];
-  initializeTargets(targets);
-  Particle particles[PARTICLE_NUMBER];
-  initializeParticles(particles);
+  bool toggle_pause = false;
+  if (!initializeGame(&game, &level, options->seed)) {
+    SDL_Log("Unable to allocate the level");
+    EXIT();
+  }
   /*********************************/
 
 #if SAVE_HIGHSCORE
-  if (readHighscore(&highscore)) {
-    highscore = 0;
-  };
+  Leaderboard leaderboard;
+  openLeaderboard(&leaderboard, &scores, LEADERBOARD_FILE_NAME);
+  game.highscore = leaderboard.count ? leaderboard.entries[0].score : 0;
 #endif
 
-  drawBackground(renderer);
-  drawProj(&proj, renderer);
-  drawBar(&bar, renderer);
-  drawTargets(targets, renderer);
+  if (options->record &&
+      openRecorder(&recorder, options->record, options->seed, &level))
+    EXIT();
+
+  FramePacer pacer = initialFramePacer(options->pacing);
+  QualityGovernor governor = initialQualityGovernor(options->adaptive_quality);
+  static Profiler profiler;
+  initializeProfiler(&profiler);
+
+  if (!initializeTripleBuffer(&snapshots, &game)) {
+    SDL_Log("Unable to allocate the snapshots");
+    EXIT();
+  }
+  startSimThread(&sim, &game, &recorder, &snapshots,
+                 SAVE_HIGHSCORE ? &scores : NULL, options->autoplay);
 
   while (!quit) {
+    TRACE_ZONE("frame");
+    const uint64_t frame_start = SDL_GetPerformanceCounter();
     SDL_Event event;
     int mouseX = -1;
     while (SDL_PollEvent(&event)) {
@@ -709,7 +4484,18 @@ int runGame(void) {
       case SDL_MOUSEMOTION: {
 
         if (event.motion.state == SDL_BUTTON_LMASK)
-          mouseX = event.button.x;
+          mouseX = event.button.x * level.scale; // in world coordinates
+        break;
+      }
+      case SDL_RENDER_TARGETS_RESET: {
+        view.target_layer.valid = false;
+        break;
+      }
+      case SDL_RENDER_DEVICE_RESET: {
+        // All textures are lost and have to be rendered again
+        clearTextCache(&view.text_cache);
+        destroyTargetLayer(&view.target_layer);
+        createTargetLayer(&view.target_layer, view.renderer);
         break;
       }
       case SDL_KEYDOWN: {
@@ -721,13 +4507,17 @@ int runGame(void) {
         }
 #endif
         case ' ': {
-          pause = !pause;
+          toggle_pause = !toggle_pause;
           break;
         }
         case 'r': {
           reset = true;
           break;
         }
+        case SDLK_F3: {
+          profiler.visible = !profiler.visible;
+          break;
+        }
         default:
           break;
         }
@@ -737,133 +4527,88 @@ int runGame(void) {
       }
     }
 
-    if (reset) {
-      bar = initialBar();
-      proj = initialProj();
-      initializeTargets(targets);
-      initializeParticles(particles);
-      started = false;
-      reset = false;
-      pause = false;
-      won = false;
-      lost = false;
-      score = 0;
-    }
-
-    bool a_pressed = keyboard_state[SDL_SCANCODE_A] != 0;
-    bool d_pressed = keyboard_state[SDL_SCANCODE_D] != 0;
-
-    if (!started && (a_pressed || d_pressed || mouseX > 0)) {
-      started = true;
-      if (mouseX > 0)
-        proj.vel.x = mouseX < (WINDOW_WIDTH / 2) ? -PROJ_SPEED : PROJ_SPEED;
-      else
-        proj.vel.x = a_pressed ? -PROJ_SPEED : PROJ_SPEED;
-    }
-
-    if (!pause && started) {
-      if (!won && !lost) {
-        if (mouseX > 0) {
-          bar.pos.x = mouseX;
-          bar.vel = 0;
-        } else if (a_pressed && !d_pressed) {
-          setBarSpeedLeft(&bar);
-        } else if (d_pressed && !a_pressed) {
-          setBarSpeedRight(&bar);
-        } else {
-          bar.vel = 0;
-        }
-        updateBar(&bar);
-        updateParticles(particles);
-
-        lost = hasLost(&proj); // must be before proj has been update
-        updateProj(&proj, targets, particles, &bar, &score);
-
-        won = hasWon(targets);
-      } else {
-        if (score > highscore) {
-          highscore = score;
-        }
-      }
-    }
-
-    drawBackground(renderer);
-    drawProj(&proj, renderer);
-    drawBar(&bar, renderer);
-    drawTargets(targets, renderer);
-    drawParticles(particles, renderer);
-    writeScore(score, highscore, renderer, score_font);
+    const GameInput input = {
+        .a_pressed = keyboard_state[SDL_SCANCODE_A] != 0,
+        .d_pressed = keyboard_state[SDL_SCANCODE_D] != 0,
+        .mouse_x = mouseX,
+        .toggle_pause = toggle_pause,
+        .reset = reset,
+    };
+    reset = false;
+    toggle_pause = false;
+    postInput(&sim, &input);
+    if (!sim.thread)
+      simStep(&sim);
+    const uint64_t events_end = SDL_GetPerformanceCounter();
 
-    if (!started) {
-      renderXYCenteredText(renderer,
-                           "Press A or D to move the bar and start the "
-                           "game. If it is too difficult use the mouse.",
-                           TEXT_COLOR, game_font);
-#if !FOR_WASM
-      renderXCenteredText(renderer,
-                          "While playing press SPACE to pause, Q "
-                          "to quit or R to restart.",
-                          TEXT_COLOR, game_font,
-                          WINDOW_HEIGHT / 2 + 20 * SCALING);
-#else
-      renderXCenteredText(renderer,
-                          "While playing press SPACE to pause or R "
-                          "to restart.",
-                          TEXT_COLOR, game_font,
-                          WINDOW_HEIGHT / 2 + 20 * SCALING);
-#endif
-    } else if (pause) {
+    if (!view.game_font && fontsLoaded(&fonts) && !takeFonts(&fonts, &view))
+      EXIT();
+    const GameSnapshot *const snapshot = latestSnapshot(&snapshots);
+    DrawTimings draw_timings = {0};
+    drawGame(&snapshot->game, &view, &draw_timings);
+    drawProfiler(&profiler, &view);
 
-#if !FOR_WASM
-      renderXYCenteredText(
-          renderer, "Press SPACE to continue, Q to quit or R to restart.",
-          TEXT_COLOR, game_font);
-#else
-      renderXYCenteredText(renderer, "Press SPACE to continue or R to restart.",
-                           TEXT_COLOR, game_font);
-#endif
-    } else if (won) {
-#if !FOR_WASM
-      renderXYCenteredText(renderer,
-                           "You won! Press R to restart or Q to quit.",
-                           TEXT_COLOR, game_font);
-#else
-      renderXYCenteredText(renderer, "You won! Press R to restart.", TEXT_COLOR,
-                           game_font);
-#endif
-    } else if (lost) {
-#if !FOR_WASM
-      renderXYCenteredText(renderer,
-                           "You lost! Press R to restart or Q to quit.",
-                           TEXT_COLOR, game_font);
-#else
-      renderXYCenteredText(renderer, "You lost! Press R to restart.",
-                           TEXT_COLOR, game_font);
-#endif
+    const uint64_t present_start = SDL_GetPerformanceCounter();
+    {
+      TRACE_ZONE("SDL_RenderPresent");
+      SDL_RenderPresent(view.renderer);
     }
-
-    SDL_RenderPresent(renderer);
-    SDL_Delay(FRAME_TARGET_TIME_MS);
+    const uint64_t present_end = SDL_GetPerformanceCounter();
+    // With vsync presenting waits for the display, which is no work. The
+    // simulation thread is over budget too if its steps take too long.
+    const uint64_t work =
+        (options->pacing == PACING_VSYNC ? present_start : present_end) -
+        frame_start;
+    uint64_t sim_work = 0;
+    for (int phase = 0; phase < SIM_PHASE_COUNT; phase++)
+      sim_work += snapshot->timings.ticks[phase];
+    const double work_ms = pacerTicksToMs(&pacer, fmax(work, sim_work));
+    SDL_AtomicSet(&sim.quality, governQuality(&governor, work_ms));
+    pacerEndFrame(&pacer);
+    profilerRecord(&profiler, events_end - frame_start, &snapshot->timings,
+                   &draw_timings, present_end - present_start,
+                   SDL_GetPerformanceCounter() - frame_start);
 
 #if FOR_WASM
     quit = quit || wasmShouldStop();
 #endif // FOR_WASM
   }
 
+  stopSimThread(&sim);
+  pacerReport(&pacer);
+  governorReport(&governor);
+
 #if SAVE_HIGHSCORE
-  saveHighscore(highscore);
+  stopScoreWriter(&scores);
+  logLeaderboard(LEADERBOARD_FILE_NAME);
 #endif
 
 quit:
-  TTF_CloseFont(game_font);
-  TTF_CloseFont(score_font);
+  stopSimThread(&sim);
+  stopScoreWriter(&scores);
+  if (closeRecorder(&recorder))
+    SET_EXIT_CODE(1);
+  clearTextCache(&view.text_cache);
+  destroyTargetLayer(&view.target_layer);
+  freeGeometryBatch(&view.batches.opaque);
+  freeGeometryBatch(&view.batches.blended);
+  freeTripleBuffer(&snapshots);
+  freeGame(&game);
+  TTF_CloseFont(view.game_font);
+  TTF_CloseFont(view.score_font);
+  stopFontLoader(&fonts);
   TTF_Quit();
-  SDL_DestroyRenderer(renderer);
+  SDL_DestroyRenderer(view.renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
   return exit_code;
 }
 
+int runGame(void) {
+  const Options options = defaultOptions();
+  return runGameWithOptions(&options);
+}
+
 #if FOR_WASM
 // NOTE: This is needed sucht that the game works when embedded in Elm. Somehow
 //  Elm does not bubble through the event.
@@ -877,4 +4622,18 @@ void sdlSendLeftMouseButtonPressed(int x, int y) {
 }
 #endif // FOR_WASM
 
-int main(void) { return runGame(); }
+// bench.c includes this file and brings its own main
+#ifndef COUT_NO_MAIN
+int main(int argc, char **argv) {
+  Options options = defaultOptions();
+  if (parseOptions(argc, argv, &options)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  startJobPool(options.jobs < 0 ? SDL_GetCPUCount() - 1 : options.jobs);
+  const int result = runGameWithOptions(&options);
+  stopJobPool();
+  traceWrite(TRACE_FILE_NAME);
+  return result;
+}
+#endif // COUT_NO_MAIN
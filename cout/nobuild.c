@@ -6,6 +6,11 @@
 
 #define EXE BIN_DIR "/cout"
 #define SRC "cout.c"
+#define BENCH_EXE BIN_DIR "/bench"
+#define BENCH_SRC "bench.c"
+#define BENCH_JSON BIN_DIR "/bench.json"
+#define FONT "Lato-Regular.ttf"
+#define EMBEDDED_FONT_HEADER BIN_DIR "/embedded_font.h"
 
 #define CPPFLAGS "-MMD", "-MP"
 #define CFLAGS "-Wall", "-Wextra", "-Wpedantic", "-Werror"
@@ -13,25 +18,63 @@
 #define SDL2LIB "-I/usr/include/SDL2 -D_REENTRANT", "-lSDL2", "-lSDL2_ttf"
 #define LDFLAGS "-lm", SDL2LIB
 
-void build_game(const int release) {
+// Writes the font as a C array, like the Makefile does with xxd
+void embed_font_header(void) {
+  FILE *const font = fopen(FONT, "rb");
+  if (!font)
+    PANIC("Could not open %s", FONT);
+  FILE *const header = fopen(EMBEDDED_FONT_HEADER, "w");
+  if (!header)
+    PANIC("Could not create %s", EMBEDDED_FONT_HEADER);
+  fputs("static const unsigned char embedded_font[] = {", header);
+  int c;
+  for (long i = 0; (c = fgetc(font)) != EOF; i++)
+    fprintf(header, "%s0x%02x,", i % 12 ? " " : "\n  ", c);
+  fputs("\n};\n", header);
+  fclose(font);
+  if (fclose(header))
+    PANIC("Could not write %s", EMBEDDED_FONT_HEADER);
+}
+
+void build_game(const int release, const int trace, const int embed_font) {
   MKDIRS(BIN_DIR);
+  const char *const trace_flag = trace ? "-DCOUT_TRACE=1" : "-DCOUT_TRACE=0";
+  const char *const font_flag =
+      embed_font ? "-DEMBED_FONT=1" : "-DEMBED_FONT=0";
+  if (embed_font)
+    embed_font_header();
   if (release) {
 #ifndef _WIN32
-    CMD("cc", CPPFLAGS, CFLAGS, "-O3", SRC, "-o", EXE, LDFLAGS);
+    CMD("cc", CPPFLAGS, CFLAGS, trace_flag, font_flag, "-I" BIN_DIR, "-O3", SRC,
+        "-o", EXE, LDFLAGS);
 #else
-    CMD("cl.exe", , CPPFLAGS, CFLAGS, "-O3", SRC, "-o", EXE, LDFLAGS);
+    CMD("cl.exe", , CPPFLAGS, CFLAGS, trace_flag, font_flag, "-I" BIN_DIR,
+        "-O3", SRC, "-o", EXE, LDFLAGS);
 #endif
   } else {
 #ifndef _WIN32
-    CMD("cc", CPPFLAGS, CFLAGS, SRC, "-o", EXE, LDFLAGS);
+    CMD("cc", CPPFLAGS, CFLAGS, trace_flag, font_flag, "-I" BIN_DIR, SRC, "-o",
+        EXE, LDFLAGS);
 #else
-    CMD("cl.exe", , CPPFLAGS, CFLAGS, SRC, "-o", EXE, LDFLAGS);
+    CMD("cl.exe", , CPPFLAGS, CFLAGS, trace_flag, font_flag, "-I" BIN_DIR, SRC,
+        "-o", EXE, LDFLAGS);
 #endif
   }
 }
 
 void run_game(void) { CMD(EXE); }
 
+// The benchmarks include cout.c and are always optimized
+void build_and_run_bench(void) {
+  MKDIRS(BIN_DIR);
+#ifndef _WIN32
+  CMD("cc", CFLAGS, "-O3", BENCH_SRC, "-o", BENCH_EXE, LDFLAGS);
+#else
+  CMD("cl.exe", CFLAGS, "-O3", BENCH_SRC, "-o", BENCH_EXE, LDFLAGS);
+#endif
+  CMD(BENCH_EXE, "--json", BENCH_JSON);
+}
+
 int main(int argc, char **argv) {
   GO_REBUILD_URSELF(argc, argv);
 
@@ -43,15 +86,23 @@ int main(int argc, char **argv) {
     release = !strcmp(release_env, "1");
   }
 
-  build_game(release);
+  const char *const trace_env = getenv("TRACE");
+  const int trace = trace_env && !strcmp(trace_env, "1");
+
+  const char *const embed_font_env = getenv("EMBED_FONT");
+  const int embed_font = embed_font_env && !strcmp(embed_font_env, "1");
+
+  build_game(release, trace, embed_font);
 
   if (argc > 1) {
     if (!strcmp(argv[1], "run")) {
       run_game();
+    } else if (!strcmp(argv[1], "bench")) {
+      build_and_run_bench();
     } else {
       printf("Nothing to do for \"%s %s\". Use \"%s run\" to build AND run the "
-             "game.\n",
-             argv[0], argv[1], argv[0]);
+             "game or \"%s bench\" to run the benchmarks.\n",
+             argv[0], argv[1], argv[0], argv[0]);
     }
   }
 
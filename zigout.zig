@@ -4,7 +4,6 @@ const sdl = @cImport({
     @cInclude("SDL2/SDL_ttf.h");
 });
 const math = std.math;
-var rand = std.Random.DefaultPrng.init(42);
 
 // --- GAME CONFIG --- //
 
@@ -46,6 +45,10 @@ const TARGET_SPACE_WIDTH = TARGET_X_SPACING * (TARGET_X_NUMBER - 1) + TARGET_WID
 const TARGET_NUMBER = TARGET_Y_NUMBER * TARGET_X_NUMBER;
 const TARGET_Y_PADDING = @divTrunc(WINDOW_HEIGHT, 10);
 const TARGET_X_PADDING = @divTrunc(WINDOW_WIDTH - TARGET_SPACE_WIDTH, 2);
+// Distance between the left (top) edges of two neighbouring targets:
+const TARGET_X_PITCH = @divTrunc(TARGET_SPACE_WIDTH, TARGET_X_NUMBER) + @divTrunc(@divTrunc(TARGET_SPACE_WIDTH, TARGET_X_NUMBER) - TARGET_WIDTH, TARGET_X_NUMBER - 1);
+const TARGET_Y_PITCH = @divTrunc(TARGET_SPACE_HEIGHT, TARGET_Y_NUMBER) + @divTrunc(@divTrunc(TARGET_SPACE_HEIGHT, TARGET_Y_NUMBER) - TARGET_HEIGHT, TARGET_Y_NUMBER - 1);
+const TARGET_WORDS = @divTrunc(TARGET_NUMBER + 63, 64);
 const TARGET_SCORE = 100;
 
 const PARTICLE_NUMBER = 1000;
@@ -58,6 +61,8 @@ const PARTICLE_SPEED_VARIABILITY = PARTICLE_SPEED - 1;
 const PARTICLE_LIFETIME_SEC = 2;
 const PARTICLE_LIFETIME_SEC_VARIABILITY = 1.5;
 
+const DEFAULT_SEED = 0x1234ABCD;
+
 // ------------------ //
 
 pub const Color = struct {
@@ -110,6 +115,45 @@ pub fn addVec(a: *const Vector2D, b: *const Vector2D) Vector2D {
     };
 }
 
+// PCG32 (XSH RR) seeded like pcg32_srandom_r(seed, RANDOM_STREAM). It is the
+// same generator as in cout/cout.c, so for the same seed both games draw the
+// same numbers.
+const RANDOM_STREAM = 54;
+const RANDOM_MULTIPLIER: u64 = 6364136223846793005;
+
+pub const Random = struct {
+    state: u64,
+    increment: u64, // odd, selects the stream
+
+    pub fn init(seed: u64) Random {
+        var random = Random{ .state = 0, .increment = (RANDOM_STREAM << 1) | 1 };
+        _ = random.next();
+        random.state +%= seed;
+        _ = random.next();
+        return random;
+    }
+
+    pub fn next(self: *Random) u32 {
+        const state = self.state;
+        self.state = state *% RANDOM_MULTIPLIER +% self.increment;
+        const xorshifted: u32 = @truncate(((state >> 18) ^ state) >> 27);
+        const rotation: u5 = @intCast(state >> 59);
+        return math.rotr(u32, xorshifted, rotation);
+    }
+
+    // Returns a number in [0, 1)
+    pub fn float(self: *Random) f32 {
+        return @as(f32, @floatFromInt(self.next() >> 8)) * 0x1p-24;
+    }
+
+    // Fills numbers with the next numbers in [0, 1)
+    pub fn fill(self: *Random, numbers: []f32) void {
+        for (numbers) |*number| {
+            number.* = self.float();
+        }
+    }
+};
+
 pub const Particle = struct {
     pos: Vector2D = .{ .x = 0, .y = 0 },
     color: Color = .{ .r = 255, .g = 46, .b = 46 },
@@ -137,20 +181,25 @@ inline fn abs(comptime T: type, a: T) T {
     return if (a >= 0) a else -a;
 }
 
-pub fn emitParticles(particles: *[PARTICLE_NUMBER]Particle, target: *const Target) void {
+pub fn emitParticles(particles: *[PARTICLE_NUMBER]Particle, random: *Random, pos: Vector2D, color: Color) void {
     var emitted: usize = 0;
-    const rnd: i32 = @intFromFloat((rand.random().float(f32) - 0.5) * PARTICLE_TO_EMIT_VARIABILITY);
+    const rnd: i32 = @intFromFloat((random.float() - 0.5) * PARTICLE_TO_EMIT_VARIABILITY);
     const to_emit = PARTICLE_TO_EMIT + rnd;
+    // Four numbers per particle. Like in cout.c they are drawn even if there
+    // are not enough free particles.
+    var numbers: [4 * (PARTICLE_TO_EMIT + PARTICLE_TO_EMIT_VARIABILITY)]f32 = undefined;
+    random.fill(numbers[0 .. 4 * @as(usize, @intCast(to_emit))]);
     for (particles) |*particle| {
         if (particle.time_alive_sec < 0) {
+            const u = numbers[4 * emitted ..][0..4];
             particle.time_alive_sec = 0;
-            particle.color = target.color;
-            particle.max_time_alive_sec += (rand.random().float(f32) - 0.5) * PARTICLE_LIFETIME_SEC_VARIABILITY;
-            particle.speed += @intFromFloat((rand.random().float(f32) - 0.5) * PARTICLE_SPEED_VARIABILITY);
-            particle.size += @intFromFloat((rand.random().float(f32) - 0.5) * PARTICLE_SIZE_VARIABLILIY);
-            particle.pos.x = target.pos.x + @divTrunc(TARGET_WIDTH, 2) - @divTrunc(particle.size, 2);
-            particle.pos.y = target.pos.y + @divTrunc(TARGET_HEIGHT, 2) - @divTrunc(particle.size, 2);
-            particle.angle = rand.random().float(f32) * math.tau;
+            particle.color = color;
+            particle.max_time_alive_sec += (u[0] - 0.5) * PARTICLE_LIFETIME_SEC_VARIABILITY;
+            particle.speed += @intFromFloat((u[1] - 0.5) * PARTICLE_SPEED_VARIABILITY);
+            particle.size += @intFromFloat((u[2] - 0.5) * PARTICLE_SIZE_VARIABLILIY);
+            particle.pos.x = pos.x + @divTrunc(TARGET_WIDTH, 2) - @divTrunc(particle.size, 2);
+            particle.pos.y = pos.y + @divTrunc(TARGET_HEIGHT, 2) - @divTrunc(particle.size, 2);
+            particle.angle = u[3] * math.tau;
             emitted += 1;
             if (emitted >= to_emit) {
                 break;
@@ -159,7 +208,7 @@ pub fn emitParticles(particles: *[PARTICLE_NUMBER]Particle, target: *const Targe
     }
 }
 
-pub fn updateProj(proj: *Projectile, targets: *[TARGET_NUMBER]Target, particles: *[PARTICLE_NUMBER]Particle, bar: *const Bar, score: *u64) void {
+pub fn updateProj(proj: *Projectile, targets: *Targets, particles: *[PARTICLE_NUMBER]Particle, random: *Random, bar: *const Bar, score: *u64) void {
     const n_pos = addVec(&proj.pos, &vecMult(&proj.vel, DELTA_TIME_SEC));
     const barRect = createBarRect(bar);
     const projRect_x = createSdlRect(n_pos.x, proj.pos.y, PROJ_WIDTH, PROJ_HEIGHT);
@@ -167,16 +216,18 @@ pub fn updateProj(proj: *Projectile, targets: *[TARGET_NUMBER]Target, particles:
 
     var intersects_target_x = false;
     var intersects_target_y = false;
-    for (targets) |*target| {
-        if (target.is_alive) {
-            const targetRect = createTargetRect(target);
+    outer: for (targets.alive, 0..) |word, word_idx| {
+        var bits = word;
+        while (bits != 0) : (bits &= bits - 1) {
+            const idx = word_idx * 64 + @ctz(bits);
+            const targetRect = createTargetRect(idx);
             intersects_target_x = sdl.SDL_HasIntersection(&targetRect, &projRect_x) != 0;
             intersects_target_y = sdl.SDL_HasIntersection(&targetRect, &projRect_y) != 0;
             if (intersects_target_x or intersects_target_y) {
-                target.is_alive = false;
+                killTarget(targets, idx);
                 score.* += TARGET_SCORE;
-                emitParticles(particles, target);
-                break;
+                emitParticles(particles, random, targetPos(idx), targetColor(targets, idx));
+                break :outer;
             }
         }
     }
@@ -203,13 +254,8 @@ pub fn hasLost(proj: *const Projectile) bool {
     return n_pos.y + PROJ_WIDTH > WINDOW_HEIGHT;
 }
 
-pub fn hasWon(targets: *[TARGET_NUMBER]Target) bool {
-    for (targets) |*target| {
-        if (target.is_alive) {
-            return false;
-        }
-    }
-    return true;
+pub fn hasWon(targets: *const Targets) bool {
+    return targets.alive_count == 0;
 }
 
 pub fn initialProj() Projectile {
@@ -297,12 +343,32 @@ pub fn drawBar(proj: *const Bar, renderer: *sdl.SDL_Renderer) void {
     _ = sdl.SDL_RenderFillRect(renderer, &rect);
 }
 
-pub const Target = struct {
-    pos: Vector2D,
-    is_alive: bool,
-    color: Color,
+// The position of a target follows from its index and its color from its row,
+// so only one alive bit per target is stored.
+pub const Targets = struct {
+    alive: [TARGET_WORDS]u64, // bit idx % 64 of word idx / 64 is target idx
+    alive_count: u32,
+    row_colors: [TARGET_Y_NUMBER]Color,
 };
 
+pub fn killTarget(targets: *Targets, idx: usize) void {
+    targets.alive[idx / 64] &= ~(@as(u64, 1) << @intCast(idx % 64));
+    targets.alive_count -= 1;
+}
+
+pub fn targetPos(idx: usize) Vector2D {
+    const idx_x: i32 = @intCast(idx % TARGET_X_NUMBER);
+    const idx_y: i32 = @intCast(idx / TARGET_X_NUMBER);
+    return .{
+        .x = TARGET_X_PADDING + TARGET_X_PITCH * idx_x,
+        .y = TARGET_Y_PADDING + TARGET_Y_PITCH * idx_y,
+    };
+}
+
+pub fn targetColor(targets: *const Targets, idx: usize) Color {
+    return targets.row_colors[idx / TARGET_X_NUMBER];
+}
+
 const LinearColor = struct {
     r: f32,
     g: f32,
@@ -371,14 +437,12 @@ fn lerp_color(color1: *const LinearColor, color2: *const LinearColor, t: f32) Li
     };
 }
 
-pub fn initialTargets() [TARGET_NUMBER]Target {
-    const dx = @divTrunc(TARGET_SPACE_WIDTH, TARGET_X_NUMBER);
-    const dy = @divTrunc(TARGET_SPACE_HEIGHT, TARGET_Y_NUMBER);
-    // Shift the targets to the right so that they are centered:
-    const align_dx = @divTrunc(dx - TARGET_WIDTH, TARGET_X_NUMBER - 1);
-    const align_dy = @divTrunc(dy - TARGET_HEIGHT, TARGET_Y_NUMBER - 1);
-
-    var targets: [TARGET_NUMBER]Target = undefined;
+pub fn initialTargets() Targets {
+    var targets = Targets{
+        .alive = undefined,
+        .alive_count = 0,
+        .row_colors = undefined,
+    };
     const red = Color{
         .r = 255,
         .g = 46,
@@ -399,37 +463,32 @@ pub fn initialTargets() [TARGET_NUMBER]Target {
     };
     const level = 0.5;
 
-    var idx: i32 = 0;
-    for (&targets) |*target| {
-        const idx_x = @mod(idx, TARGET_X_NUMBER);
-        const idx_y = @divTrunc(idx, TARGET_X_NUMBER);
-        const pos_x = TARGET_X_PADDING + (dx + align_dx) * idx_x;
-        const pos_y = TARGET_Y_PADDING + (dy + align_dy) * idx_y;
-
+    for (&targets.row_colors, 0..) |*row_color, idx_y| {
         const t: f32 = @as(f32, @floatFromInt(idx_y)) / @as(f32, @floatFromInt(TARGET_Y_NUMBER));
-        const target_color = if (t < level) lerp_color_gamma_corrected(&red, &green, t / level) else lerp_color_gamma_corrected(&green, &blue, (t - level) / (1 - level));
-        target.* = Target{
-            .pos = .{
-                .x = pos_x,
-                .y = pos_y,
-            },
-            .is_alive = true,
-            .color = target_color,
-        };
-        idx += 1;
+        row_color.* = if (t < level) lerp_color_gamma_corrected(&red, &green, t / level) else lerp_color_gamma_corrected(&green, &blue, (t - level) / (1 - level));
+    }
+
+    for (&targets.alive, 0..) |*word, word_idx| {
+        const remaining = TARGET_NUMBER - word_idx * 64;
+        word.* = if (remaining >= 64) ~@as(u64, 0) else (@as(u64, 1) << @intCast(remaining)) - 1;
+        targets.alive_count += @popCount(word.*);
     }
     return targets;
 }
 
-pub fn createTargetRect(target: *const Target) sdl.SDL_Rect {
-    return createSdlRect(target.pos.x, target.pos.y, TARGET_WIDTH, TARGET_HEIGHT);
+pub fn createTargetRect(idx: usize) sdl.SDL_Rect {
+    const pos = targetPos(idx);
+    return createSdlRect(pos.x, pos.y, TARGET_WIDTH, TARGET_HEIGHT);
 }
 
-pub fn drawTargets(targets: *const [TARGET_NUMBER]Target, renderer: *sdl.SDL_Renderer) void {
-    for (targets) |*target| {
-        if (target.is_alive) {
-            const rect = createTargetRect(target);
-            _ = sdl.SDL_SetRenderDrawColor(renderer, target.color.r, target.color.g, target.color.b, target.color.a);
+pub fn drawTargets(targets: *const Targets, renderer: *sdl.SDL_Renderer) void {
+    for (targets.alive, 0..) |word, word_idx| {
+        var bits = word;
+        while (bits != 0) : (bits &= bits - 1) {
+            const idx = word_idx * 64 + @ctz(bits);
+            const rect = createTargetRect(idx);
+            const color = targetColor(targets, idx);
+            _ = sdl.SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
             _ = sdl.SDL_RenderFillRect(renderer, &rect);
         }
     }
@@ -613,6 +672,7 @@ pub fn runGame() !void {
     var proj = initialProj();
     var targets = initialTargets();
     var particles = initialParticles();
+    var random = Random.init(DEFAULT_SEED);
     // --------------------------- //
 
     if (SAVE_HIGHSCORE) {
@@ -675,7 +735,7 @@ pub fn runGame() !void {
                 updateParticles(&particles);
 
                 lost = hasLost(&proj); // must be before proj has been updated
-                updateProj(&proj, &targets, &particles, &bar, &score);
+                updateProj(&proj, &targets, &particles, &random, &bar, &score);
 
                 won = hasWon(&targets);
             } else {